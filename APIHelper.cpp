@@ -1,5 +1,6 @@
 #include "APIHelper.h"
 
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -17,6 +18,68 @@ Class::~Class()
 	free(m_ClassName);
 }
 
+// Concurrent resolves of the same row store the same ID, relaxed is enough as IDs stay valid while the class is loaded
+jmethodID ResolveMethod(MethodTable& table, int index)
+{
+	jmethodID id = table.ids[index].load(std::memory_order_relaxed);
+	if (id)
+		return id;
+	const MethodDescriptor& method = table.descriptors[index];
+	id = method.isStatic
+		? jni::GetStaticMethodID(table.clazz, method.name, method.signature)
+		: jni::GetMethodID(table.clazz, method.name, method.signature);
+	table.ids[index].store(id, std::memory_order_relaxed);
+	return id;
+}
+
+template <typename T> inline char ReturnKind() { return 'L'; }
+template <> inline char ReturnKind<jvoid>()    { return 'V'; }
+template <> inline char ReturnKind<jboolean>() { return 'Z'; }
+template <> inline char ReturnKind<jbyte>()    { return 'B'; }
+template <> inline char ReturnKind<jchar>()    { return 'C'; }
+template <> inline char ReturnKind<jshort>()   { return 'S'; }
+template <> inline char ReturnKind<jint>()     { return 'I'; }
+template <> inline char ReturnKind<jlong>()    { return 'J'; }
+template <> inline char ReturnKind<jfloat>()   { return 'F'; }
+template <> inline char ReturnKind<jdouble>()  { return 'D'; }
+
+template <typename T> T CallMethod(jobject object, MethodTable& table, int index, ...)
+{
+	assert(!table.descriptors[index].isStatic && table.descriptors[index].returnKind == ReturnKind<T>());
+	va_list args;
+	va_start(args, index);
+	T result = Op<T>::CallMethodV(object, ResolveMethod(table, index), args);
+	va_end(args);
+	return result;
+}
+
+template <typename T> T CallStaticMethod(MethodTable& table, int index, ...)
+{
+	assert(table.descriptors[index].isStatic && table.descriptors[index].returnKind == ReturnKind<T>());
+	va_list args;
+	va_start(args, index);
+	T result = Op<T>::CallStaticMethodV(table.clazz, ResolveMethod(table, index), args);
+	va_end(args);
+	return result;
+}
+
+#define INSTANTIATE_TRAMPOLINES(T) \
+	template T CallMethod<T>(jobject, MethodTable&, int, ...); \
+	template T CallStaticMethod<T>(MethodTable&, int, ...);
+
+INSTANTIATE_TRAMPOLINES(jvoid)
+INSTANTIATE_TRAMPOLINES(jboolean)
+INSTANTIATE_TRAMPOLINES(jbyte)
+INSTANTIATE_TRAMPOLINES(jchar)
+INSTANTIATE_TRAMPOLINES(jshort)
+INSTANTIATE_TRAMPOLINES(jint)
+INSTANTIATE_TRAMPOLINES(jlong)
+INSTANTIATE_TRAMPOLINES(jfloat)
+INSTANTIATE_TRAMPOLINES(jdouble)
+INSTANTIATE_TRAMPOLINES(jobject)
+
+#undef INSTANTIATE_TRAMPOLINES
+
 
 
 
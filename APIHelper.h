@@ -1,6 +1,14 @@
 #pragma once
 
 #include "JNIBridge.h"
+#include <string.h>
+#include <atomic>
+#include <limits>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define JNI_STRING_VIEW 1
+#include <string_view>
+#endif
 
 #if WINDOWS
 #include <Windows.h>
@@ -140,6 +148,8 @@ public:
 		return m_Class = jni::FindClass(m_ClassName);
 	}
 
+	inline const char* GetName() const { return m_ClassName; }
+
 private:
 	Class(const Class& clazz);
 	Class& operator = (const Class& o);
@@ -170,6 +180,16 @@ template <typename T> inline T Cast(jobject o) { return T(InstanceOf<T>(o) ? o :
 template <typename T> inline bool Catch() { return jni::ExceptionThrown(T::__CLASS); }
 template <typename T> inline bool ThrowNew(const char* message) { return jni::ThrowNew(T::__CLASS, message) == 0; }
 
+// Primitives passed through a jlong slot (see JNIBridge.InterfaceProxy.toRawBits)
+template <typename T> inline T FromRawBits(jlong bits) { return static_cast<T>(bits); }
+template <> inline jboolean FromRawBits<jboolean>(jlong bits) { return bits != 0; }
+template <> inline jfloat FromRawBits<jfloat>(jlong bits) { jint raw = static_cast<jint>(bits); jfloat value; memcpy(&value, &raw, sizeof(value)); return value; }
+template <> inline jdouble FromRawBits<jdouble>(jlong bits) { jdouble value; memcpy(&value, &bits, sizeof(value)); return value; }
+
+template <typename T> inline jlong ToRawBits(T value) { return static_cast<jlong>(value); }
+template <> inline jlong ToRawBits<jfloat>(jfloat value) { jint raw; memcpy(&raw, &value, sizeof(raw)); return raw; }
+template <> inline jlong ToRawBits<jdouble>(jdouble value) { jlong raw; memcpy(&raw, &value, sizeof(raw)); return raw; }
+
 // ------------------------------------------------	
 // Array Support
 // ------------------------------------------------
@@ -227,7 +247,7 @@ public:
 
 	inline T* LockCritical() const
 	{
-		return *this ? jni::GetPrimitiveArrayCritical(*this, NULL) : 0;
+		return *this ? static_cast<T*>(jni::GetPrimitiveArrayCritical(*this, NULL)) : 0;
 	}
 	inline void ReleaseCritical(T* elements, bool writeBackData = true) const
 	{
@@ -319,6 +339,32 @@ DEF_PRIMITIVE_ARRAY_TYPE(jchar)
 
 #undef DEF_PRIMITIVE_ARRAY_TYPE
 
+// ------------------------------------------------
+// Compact generated code (APIGenerator --compact)
+// ------------------------------------------------
+// One constant row per generated method, generated members call through the shared typed
+// trampolines below with their row index instead of each carrying its own ID cache and Op call
+struct MethodDescriptor
+{
+	const char* name;
+	const char* signature;
+	bool        isStatic;
+	char        returnKind; // Return type as in a signature, 'L' for objects and arrays
+};
+
+struct MethodTable
+{
+	Class&                  clazz;
+	const MethodDescriptor* descriptors;
+	std::atomic<jmethodID>* ids;
+};
+
+jmethodID ResolveMethod(MethodTable& table, int index);
+
+// Instantiated in APIHelper.cpp for jvoid, the primitives and jobject
+template <typename T> T CallMethod(jobject object, MethodTable& table, int index, ...);
+template <typename T> T CallStaticMethod(MethodTable& table, int index, ...);
+
 // ------------------------------------------------
 // Proxy Support
 // ------------------------------------------------
@@ -328,6 +374,7 @@ public:
 	ProxyInvoker() {}
 	virtual ~ProxyInvoker() {};
 	virtual jobject __Invoke(jclass, jmethodID, jobjectArray) = 0;
+	virtual jobject __InvokeUnboxed(jclass, jmethodID, jobjectArray, const jlong*, jlong*) = 0;
 
 public:
 	static bool __Register();
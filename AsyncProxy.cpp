@@ -0,0 +1,235 @@
+#include "AsyncProxy.h"
+#include <stdint.h>
+
+namespace jni
+{
+
+struct ProxyDispatchQueue::Call
+{
+	Call(const std::shared_ptr<ProxyDispatchTarget>& target, jclass clazz, jmethodID methodID, jobjectArray args)
+	: target(target)
+	, clazz(static_cast<jclass>(jni::NewGlobalRef(clazz)))
+	, methodID(methodID)
+	, args(static_cast<jobjectArray>(args ? jni::NewGlobalRef(args) : NULL))
+	{
+	}
+
+	~Call()
+	{
+		jni::DeleteGlobalRef(clazz);
+		if (args)
+			jni::DeleteGlobalRef(args);
+	}
+
+	std::shared_ptr<ProxyDispatchTarget> target;
+	jclass clazz;
+	jmethodID methodID;
+	jobjectArray args;
+};
+
+ProxyDispatchQueue::ProxyDispatchQueue(unsigned capacity, ProxyOverflowPolicy policy)
+: m_Policy(policy)
+, m_EnqueuePos(0)
+, m_DequeuePos(0)
+, m_Posted(0)
+, m_Executed(0)
+, m_Dropped(0)
+, m_WorkerWaiting(false)
+, m_WorkerRunning(false)
+{
+	size_t size = 2;
+	while (size < capacity)
+		size <<= 1;
+	m_Mask = size - 1;
+	m_Cells = new Cell[size];
+	for (size_t i = 0; i < size; ++i)
+		m_Cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+ProxyDispatchQueue::~ProxyDispatchQueue()
+{
+	StopWorker();
+	while (Call* call = TryPop())
+		Discard(call);
+	delete[] m_Cells;
+}
+
+ProxyDispatchQueue& ProxyDispatchQueue::Default()
+{
+	static ProxyDispatchQueue queue;
+	return queue;
+}
+
+bool ProxyDispatchQueue::TryPush(Call* call)
+{
+	Cell* cell;
+	size_t pos = m_EnqueuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		cell = &m_Cells[pos & m_Mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+		if (diff == 0)
+		{
+			if (m_EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+			return false;
+		else
+			pos = m_EnqueuePos.load(std::memory_order_relaxed);
+	}
+	cell->call = call;
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+ProxyDispatchQueue::Call* ProxyDispatchQueue::TryPop()
+{
+	Cell* cell;
+	size_t pos = m_DequeuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		cell = &m_Cells[pos & m_Mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+		if (diff == 0)
+		{
+			if (m_DequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+			return NULL;
+		else
+			pos = m_DequeuePos.load(std::memory_order_relaxed);
+	}
+	Call* call = cell->call;
+	cell->sequence.store(pos + m_Mask + 1, std::memory_order_release);
+	return call;
+}
+
+unsigned ProxyDispatchQueue::GetPending() const
+{
+	size_t enqueuePos = m_EnqueuePos.load(std::memory_order_relaxed);
+	size_t dequeuePos = m_DequeuePos.load(std::memory_order_relaxed);
+	return enqueuePos > dequeuePos ? static_cast<unsigned>(enqueuePos - dequeuePos) : 0;
+}
+
+bool ProxyDispatchQueue::Post(const std::shared_ptr<ProxyDispatchTarget>& target, jclass clazz, jmethodID methodID, jobjectArray args)
+{
+	Call* call = new Call(target, clazz, methodID, args);
+	while (!TryPush(call))
+	{
+		switch (m_Policy)
+		{
+		case kProxyDropNewest:
+			Discard(call);
+			return false;
+		case kProxyDropOldest:
+			if (Call* oldest = TryPop())
+				Discard(oldest);
+			break;
+		case kProxyBlock:
+			std::this_thread::yield();
+			break;
+		case kProxyRunInline:
+			m_Posted.fetch_add(1, std::memory_order_relaxed);
+			Execute(call);
+			return true;
+		}
+	}
+	m_Posted.fetch_add(1, std::memory_order_relaxed);
+
+	// Pairs with the fence in WorkerLoop, either the worker sees this call pending or this sees the worker waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_WorkerWaiting.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> lock(m_WorkerLock);
+		m_WorkerWakeup.notify_one();
+	}
+	return true;
+}
+
+void ProxyDispatchQueue::Discard(Call* call)
+{
+	m_Dropped.fetch_add(1, std::memory_order_relaxed);
+	delete call;
+}
+
+void ProxyDispatchQueue::Execute(Call* call)
+{
+	{
+		jni::LocalScope frame;
+		std::lock_guard<std::recursive_mutex> lock(call->target->lock);
+		if (ProxyObject* proxy = call->target->proxy)
+			proxy->__Invoke(call->clazz, call->methodID, call->args);
+
+		// Nobody is waiting for the result, so don't let an exception leak into the next call
+		JNIEnv* env = frame;
+		if (env && env->ExceptionCheck())
+		{
+			env->ExceptionDescribe();
+			env->ExceptionClear();
+		}
+		jni::CheckError();
+	}
+	m_Executed.fetch_add(1, std::memory_order_relaxed);
+	delete call;
+}
+
+unsigned ProxyDispatchQueue::Drain(unsigned maxCalls)
+{
+	unsigned nCalls = 0;
+	while (nCalls < maxCalls)
+	{
+		Call* call = TryPop();
+		if (!call)
+			break;
+		Execute(call);
+		++nCalls;
+	}
+	return nCalls;
+}
+
+bool ProxyDispatchQueue::StartWorker()
+{
+	if (m_WorkerRunning.exchange(true))
+		return false;
+	m_Worker = std::thread(&ProxyDispatchQueue::WorkerLoop, this);
+	return true;
+}
+
+void ProxyDispatchQueue::StopWorker()
+{
+	if (!m_WorkerRunning.exchange(false))
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_WorkerLock);
+		m_WorkerWakeup.notify_one();
+	}
+	m_Worker.join();
+}
+
+void ProxyDispatchQueue::WorkerLoop()
+{
+	if (!jni::AttachCurrentThread())
+		return;
+
+	while (m_WorkerRunning.load(std::memory_order_relaxed))
+	{
+		if (Drain(64))
+			continue;
+
+		// A post that misses m_WorkerWaiting is seen by GetPending, the lock is held until wait releases it,
+		// so a post that does see it can't notify before the worker waits
+		std::unique_lock<std::mutex> lock(m_WorkerLock);
+		m_WorkerWaiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!GetPending() && m_WorkerRunning.load(std::memory_order_relaxed))
+			m_WorkerWakeup.wait(lock);
+		m_WorkerWaiting.store(false, std::memory_order_relaxed);
+	}
+	jni::DetachCurrentThread();
+}
+
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include "Proxy.h"
+
+namespace jni
+{
+
+// What ProxyDispatchQueue::Post does when the queue is full
+enum ProxyOverflowPolicy
+{
+	kProxyDropNewest = 0,	// discard the call being posted
+	kProxyDropOldest,		// discard the oldest queued call to make room
+	kProxyBlock,			// spin until the consumer makes room, only use with a worker thread
+	kProxyRunInline			// run the call on the posting Java thread
+};
+
+// Shared between an async proxy and the calls it has queued, so they can outlive the proxy
+struct ProxyDispatchTarget
+{
+	explicit ProxyDispatchTarget(ProxyObject* proxy) : proxy(proxy) {}
+
+	std::recursive_mutex lock;
+	ProxyObject* proxy;
+};
+
+// Bounded lock-free queue of proxy calls (Vyukov's array based queue).
+// Any Java thread may post, calls are executed by Drain() or by the worker thread.
+class ProxyDispatchQueue
+{
+public:
+	explicit ProxyDispatchQueue(unsigned capacity = 1024, ProxyOverflowPolicy policy = kProxyDropNewest);
+	~ProxyDispatchQueue();
+
+	bool Post(const std::shared_ptr<ProxyDispatchTarget>& target, jclass clazz, jmethodID methodID, jobjectArray args);
+
+	// Runs up to maxCalls queued calls on the current thread, returns how many were run
+	unsigned Drain(unsigned maxCalls = ~0u);
+
+	// Optional native thread draining the queue as calls come in
+	bool StartWorker();
+	void StopWorker();
+
+	unsigned GetPending() const;
+	jlong GetPosted() const   { return m_Posted.load(std::memory_order_relaxed); }
+	jlong GetExecuted() const { return m_Executed.load(std::memory_order_relaxed); }
+	jlong GetDropped() const  { return m_Dropped.load(std::memory_order_relaxed); }
+
+	static ProxyDispatchQueue& Default();
+
+private:
+	struct Call;
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		Call* call;
+	};
+
+	ProxyDispatchQueue(const ProxyDispatchQueue&);
+	ProxyDispatchQueue& operator = (const ProxyDispatchQueue&);
+
+	bool TryPush(Call* call);
+	Call* TryPop();
+	void Execute(Call* call);
+	void Discard(Call* call);
+	void WorkerLoop();
+
+	Cell* m_Cells;
+	size_t m_Mask;
+	ProxyOverflowPolicy m_Policy;
+	alignas(64) std::atomic<size_t> m_EnqueuePos;
+	alignas(64) std::atomic<size_t> m_DequeuePos;
+
+	std::atomic<jlong> m_Posted;
+	std::atomic<jlong> m_Executed;
+	std::atomic<jlong> m_Dropped;
+
+	std::thread m_Worker;
+	std::mutex m_WorkerLock;
+	std::condition_variable m_WorkerWakeup;
+	std::atomic<bool> m_WorkerWaiting;
+	std::atomic<bool> m_WorkerRunning;
+};
+
+// Void interface methods are queued on GetDispatchQueue() and Java returns right away.
+// Methods with a result and default methods still run synchronously on the calling Java thread.
+template <class RefAllocator, class ...TX>
+class AsyncProxyGenerator : public ProxyGenerator<RefAllocator, TX...>
+{
+public:
+	void DisableProxy() override
+	{
+		Detach();
+		ProxyGenerator<RefAllocator, TX...>::DisableProxy();
+	}
+
+	jobject __InvokeAsync(jclass clazz, jmethodID mid, jobjectArray args) override
+	{
+		GetDispatchQueue().Post(m_Target, clazz, mid, args);
+		return NULL;
+	}
+
+protected:
+	AsyncProxyGenerator() : m_Target(std::make_shared<ProxyDispatchTarget>(static_cast<ProxyObject*>(this))) {}
+
+	virtual ~AsyncProxyGenerator()
+	{
+		Detach();
+	}
+
+	virtual ProxyDispatchQueue& GetDispatchQueue() { return ProxyDispatchQueue::Default(); }
+
+	bool __IsAsync() const override { return true; }
+
+private:
+	// Waits for a call that is running right now, queued ones are dropped when they come up
+	void Detach()
+	{
+		std::lock_guard<std::recursive_mutex> lock(m_Target->lock);
+		m_Target->proxy = NULL;
+	}
+
+	std::shared_ptr<ProxyDispatchTarget> m_Target;
+};
+
+template <class ...TX> class AsyncProxy     : public AsyncProxyGenerator<GlobalRefAllocator, TX...> {};
+template <class ...TX> class WeakAsyncProxy : public AsyncProxyGenerator<WeakGlobalRefAllocator, TX...> {};
+
+}
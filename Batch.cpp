@@ -0,0 +1,206 @@
+#include "Batch.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace jni
+{
+
+static jni::Class s_BatchBridgeClass("bitter/jnibridge/JNIBridge");
+static jni::Class s_BatchObjectClass("java/lang/Object");
+
+// Reflected method and parameter type codes (see JNIBridge.batchSignature), resolved once per jmethodID
+struct BatchMethod
+{
+	jobject method;
+	std::string parameters;
+};
+
+// The lookup is done outside of the lock, it calls into Java
+static const BatchMethod* ResolveBatchMethod(jobject object, jclass clazz, jmethodID id)
+{
+	static std::mutex lock;
+	static std::unordered_map<jmethodID, BatchMethod> methods;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::unordered_map<jmethodID, BatchMethod>::const_iterator it = methods.find(id);
+		if (it != methods.end())
+			return &it->second;
+	}
+
+	static jmethodID signatureMID = jni::GetStaticMethodID(s_BatchBridgeClass, "batchSignature", "(Ljava/lang/reflect/Method;)Ljava/lang/String;");
+	jclass owner = object ? jni::GetObjectClass(object) : clazz;
+	jobject method = jni::ToReflectedMethod(owner, id, object == NULL);
+	jstring parameters = static_cast<jstring>(jni::Op<jobject>::CallStaticMethod(s_BatchBridgeClass, signatureMID, method));
+
+	BatchMethod resolved;
+	resolved.method = NULL;
+	if (const char* chars = parameters ? jni::GetStringUTFChars(parameters) : NULL)
+	{
+		resolved.parameters = chars;
+		jni::ReleaseStringUTFChars(parameters, chars);
+		resolved.method = jni::NewGlobalRef(method);
+	}
+
+	jni::DeleteLocalRef(parameters);
+	jni::DeleteLocalRef(method);
+	if (object)
+		jni::DeleteLocalRef(owner);
+	if (!resolved.method)
+		return NULL;
+
+	std::lock_guard<std::mutex> guard(lock);
+	std::pair<std::unordered_map<jmethodID, BatchMethod>::iterator, bool> inserted = methods.insert(std::make_pair(id, resolved));
+	// Another thread got there first
+	if (!inserted.second)
+		jni::DeleteGlobalRef(resolved.method);
+	return &inserted.first->second;
+}
+
+Batch::Batch()
+: m_Count(0)
+, m_Results(NULL)
+{
+}
+
+Batch::~Batch()
+{
+	Clear();
+}
+
+void Batch::Clear()
+{
+	Truncate(0, 0, 0);
+	m_Count = 0;
+	if (m_Results)
+		jni::DeleteGlobalRef(m_Results);
+	m_Results = NULL;
+}
+
+// Drops whatever was recorded past the given sizes
+void Batch::Truncate(size_t objects, size_t primitives, size_t commands)
+{
+	for (size_t i = objects; i < m_Objects.size(); ++i)
+		if (m_Objects[i])
+			jni::DeleteGlobalRef(m_Objects[i]);
+	m_Objects.resize(objects);
+	m_Primitives.resize(primitives);
+	m_Commands.resize(commands);
+}
+
+// Objects are held as global refs until the batch runs, the Object[] is only built once in Execute()
+bool Batch::AddObject(jobject object)
+{
+	jobject ref = object ? jni::NewGlobalRef(object) : NULL;
+	if (object && !ref)
+		return false;
+	m_Objects.push_back(ref);
+	m_Commands.push_back(static_cast<jint>(m_Objects.size() - 1));
+	return true;
+}
+
+void Batch::Call(jobject object, jmethodID id, ...)
+{
+	va_list args;
+	va_start(args, id);
+	CallV(object, NULL, id, args);
+	va_end(args);
+}
+
+void Batch::CallStatic(jclass clazz, jmethodID id, ...)
+{
+	va_list args;
+	va_start(args, id);
+	CallV(NULL, clazz, id, args);
+	va_end(args);
+}
+
+// Command layout: target object index (-1 for static calls), method index, one index per argument.
+// A call that can't be recorded completely is taken out again.
+bool Batch::CallV(jobject object, jclass clazz, jmethodID id, va_list args)
+{
+	if (CheckForParameterError((object || clazz) && id))
+		return false;
+
+	const BatchMethod* method = ResolveBatchMethod(object, clazz, id);
+	if (!method)
+		return false;
+
+	const size_t objects = m_Objects.size();
+	const size_t primitives = m_Primitives.size();
+	const size_t commands = m_Commands.size();
+
+	bool added = true;
+	if (object)
+		added = AddObject(object);
+	else
+		m_Commands.push_back(-1);
+	added = added && AddObject(method->method);
+	for (std::string::const_iterator type = method->parameters.begin(); added && type != method->parameters.end(); ++type)
+	{
+		switch (*type)
+		{
+			case 'L': added = AddObject(va_arg(args, jobject)); continue;
+			case 'J': m_Primitives.push_back(va_arg(args, jlong)); break;
+			case 'F': m_Primitives.push_back(jni::ToRawBits(static_cast<jfloat>(va_arg(args, jdouble)))); break;
+			case 'D': m_Primitives.push_back(jni::ToRawBits(va_arg(args, jdouble))); break;
+			default:  m_Primitives.push_back(va_arg(args, jint)); break; // Z, B, C, S and I are promoted to int
+		}
+		m_Commands.push_back(static_cast<jint>(m_Primitives.size() - 1));
+	}
+
+	if (!added)
+	{
+		Truncate(objects, primitives, commands);
+		return false;
+	}
+	++m_Count;
+	return true;
+}
+
+jint Batch::Execute()
+{
+	if (!m_Count)
+		return -1;
+
+	static jmethodID executeMID = jni::GetStaticMethodID(s_BatchBridgeClass, "executeBatch", "([Ljava/lang/Object;[J[I[Ljava/lang/Object;)I");
+
+	jni::LocalScope frame;
+	jobjectArray objects = jni::NewObjectArray(static_cast<jsize>(m_Objects.size()), s_BatchObjectClass);
+	for (size_t i = 0; objects && i < m_Objects.size(); ++i)
+		jni::SetObjectArrayElement(objects, static_cast<jsize>(i), m_Objects[i]);
+	jlongArray primitives = jni::Op<jlong>::NewArray(static_cast<jsize>(m_Primitives.size()));
+	if (!m_Primitives.empty())
+		jni::Op<jlong>::SetArrayRegion(primitives, 0, static_cast<jsize>(m_Primitives.size()), &m_Primitives[0]);
+	jintArray commands = jni::Op<jint>::NewArray(static_cast<jsize>(m_Commands.size()));
+	jni::Op<jint>::SetArrayRegion(commands, 0, static_cast<jsize>(m_Commands.size()), &m_Commands[0]);
+	jobjectArray results = jni::NewObjectArray(m_Count, s_BatchObjectClass);
+
+	// An exception escaping executeBatch itself is left pending and reported as a failure of the first call
+	jint failed = jni::Op<jint>::CallStaticMethod(s_BatchBridgeClass, executeMID, objects, primitives, commands, results);
+
+	Truncate(0, 0, 0);
+	m_Count = 0;
+	if (m_Results)
+		jni::DeleteGlobalRef(m_Results);
+	m_Results = static_cast<jobjectArray>(jni::NewGlobalRef(results));
+
+	if (failed >= 0 && results)
+	{
+		JNIEnv* env = frame;
+		jthrowable throwable = static_cast<jthrowable>(jni::GetObjectArrayElement(results, failed));
+		if (throwable && !env->ExceptionCheck())
+		{
+			env->Throw(throwable);
+			CheckForExceptionError(env);
+		}
+	}
+	return failed;
+}
+
+jobject Batch::GetResult(jsize index) const
+{
+	return m_Results ? jni::GetObjectArrayElement(m_Results, index) : NULL;
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include "APIHelper.h"
+
+namespace jni
+{
+
+// Records calls and replays them in a single crossing through JNIBridge.executeBatch.
+// Arguments are captured when recorded, so temporaries passed to generated wrappers are fine.
+// Only calls made through Call/CallStatic are recorded. Any other call runs right away,
+// so it doesn't see the effects of recorded calls until Execute().
+class Batch
+{
+public:
+	Batch();
+	~Batch();
+
+	void Call(jobject object, jmethodID id, ...);
+	void CallStatic(jclass clazz, jmethodID id, ...);
+	bool CallV(jobject object, jclass clazz, jmethodID id, va_list args);
+
+	// Returns the index of the first failed call, or -1 if all succeeded.
+	// Calls after a failure are skipped and its exception is left pending, like for a direct call.
+	jint Execute();
+
+	// Boxed result of a call from the last Execute(), or the Throwable of the failed one
+	jobject GetResult(jsize index) const;
+
+	jsize Size() const { return m_Count; }
+	void Clear();
+
+private:
+	Batch(const Batch&);
+	Batch& operator = (const Batch&);
+
+	bool AddObject(jobject object);
+	void Truncate(size_t objects, size_t primitives, size_t commands);
+
+	std::vector<jobject> m_Objects;
+	std::vector<jlong> m_Primitives;
+	std::vector<jint> m_Commands;
+	jsize m_Count;
+	jobjectArray m_Results;
+};
+
+}
@@ -0,0 +1,72 @@
+#include "ChunkedRange.h"
+
+namespace jni
+{
+
+static jni::Class s_ChunkBridgeClass("bitter/jnibridge/JNIBridge");
+static jni::Class s_ChunkObjectClass("java/lang/Object");
+
+ChunkedRangeBase::ChunkedRangeBase(jobject source, jsize chunkSize)
+: m_Current(NULL)
+, m_Source(NULL)
+, m_Chunk(NULL)
+, m_ChunkSize(chunkSize > 0 ? chunkSize : 1)
+, m_Count(0)
+, m_Index(0)
+, m_Exhausted(true)
+{
+	if (!source)
+		return;
+
+	static jmethodID iterateMID = jni::GetStaticMethodID(s_ChunkBridgeClass, "iterate", "(Ljava/lang/Object;)Ljava/lang/Object;");
+	jobject iterator = jni::Op<jobject>::CallStaticMethod(s_ChunkBridgeClass, iterateMID, source);
+	jobjectArray chunk = iterator ? jni::NewObjectArray(m_ChunkSize, s_ChunkObjectClass) : NULL;
+	if (chunk)
+	{
+		m_Source = jni::NewGlobalRef(iterator);
+		m_Chunk = static_cast<jobjectArray>(jni::NewGlobalRef(chunk));
+		m_Exhausted = false;
+		jni::DeleteLocalRef(chunk);
+	}
+	if (iterator)
+		jni::DeleteLocalRef(iterator);
+}
+
+ChunkedRangeBase::~ChunkedRangeBase()
+{
+	if (m_Current)
+		jni::DeleteLocalRef(m_Current);
+	if (m_Chunk)
+		jni::DeleteGlobalRef(m_Chunk);
+	if (m_Source)
+		jni::DeleteGlobalRef(m_Source);
+}
+
+bool ChunkedRangeBase::Next()
+{
+	if (m_Current)
+		jni::DeleteLocalRef(m_Current);
+	m_Current = NULL;
+
+	if (m_Index == m_Count)
+	{
+		if (m_Exhausted)
+			return false;
+
+		static jmethodID fillChunkMID = jni::GetStaticMethodID(s_ChunkBridgeClass, "fillChunk", "(Ljava/lang/Object;[Ljava/lang/Object;)I");
+		m_Count = jni::Op<jint>::CallStaticMethod(s_ChunkBridgeClass, fillChunkMID, m_Source, m_Chunk);
+		m_Index = 0;
+		// A short chunk means the source ran out, which saves asking again
+		m_Exhausted = m_Count < m_ChunkSize;
+		if (m_Count <= 0)
+		{
+			m_Count = 0;
+			return false;
+		}
+	}
+
+	m_Current = jni::GetObjectArrayElement(m_Chunk, m_Index++);
+	return true;
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "APIHelper.h"
+
+namespace jni
+{
+
+// Pulls elements of a java.lang.Iterable, java.util.Iterator or Enumeration through JNIBridge.fillChunk,
+// which costs one crossing per chunk instead of two (hasNext/next) per element.
+class ChunkedRangeBase
+{
+public:
+	static const jsize kDefaultChunkSize = 64;
+
+protected:
+	ChunkedRangeBase(jobject source, jsize chunkSize);
+	~ChunkedRangeBase();
+
+	// Advances m_Current, returns false once the source is exhausted or threw
+	bool Next();
+
+	jobject m_Current;
+
+private:
+	ChunkedRangeBase(const ChunkedRangeBase&);
+	ChunkedRangeBase& operator = (const ChunkedRangeBase&);
+
+	jobject m_Source;
+	jobjectArray m_Chunk;
+	jsize m_ChunkSize;
+	jsize m_Count;
+	jsize m_Index;
+	bool m_Exhausted;
+};
+
+// Range-for adapter, e.g. for (java::lang::String key : jni::ChunkedRange<java::lang::String>(properties.Keys()))
+// With the default T each element is a local ref which is deleted when the range advances past it,
+// a generated type (holding a global ref) is needed to keep an element around longer.
+template <typename T = jobject>
+class ChunkedRange : public ChunkedRangeBase
+{
+public:
+	explicit ChunkedRange(jobject source, jsize chunkSize = kDefaultChunkSize) : ChunkedRangeBase(source, chunkSize) {}
+
+	class iterator
+	{
+	public:
+		explicit iterator(ChunkedRange* range) : m_Range(range) {}
+
+		inline T operator * () const { return T(m_Range->m_Current); }
+		inline iterator& operator ++ () { if (!m_Range->Next()) m_Range = NULL; return *this; }
+		inline bool operator == (const iterator& o) const { return m_Range == o.m_Range; }
+		inline bool operator != (const iterator& o) const { return m_Range != o.m_Range; }
+
+	private:
+		ChunkedRange* m_Range;
+	};
+
+	// Single pass, like the Java iterator underneath
+	iterator begin() { return iterator(Next() ? this : NULL); }
+	iterator end()   { return iterator(NULL); }
+};
+
+}
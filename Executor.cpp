@@ -0,0 +1,87 @@
+#include "Executor.h"
+
+namespace jni
+{
+
+Executor::Executor(unsigned nThreads, jint localFrameCapacity)
+: m_LocalFrameCapacity(localFrameCapacity)
+, m_Stopping(false)
+{
+	if (nThreads == 0)
+		nThreads = 1;
+	m_Threads.reserve(nThreads);
+	for (unsigned i = 0; i < nThreads; ++i)
+		m_Threads.push_back(std::thread(&Executor::WorkerLoop, this));
+}
+
+// Tasks that are already queued still run before the threads are joined
+Executor::~Executor()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Stopping = true;
+	}
+	m_Wakeup.notify_all();
+	for (std::thread& thread : m_Threads)
+		thread.join();
+}
+
+void Executor::Enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Tasks.push_back(std::move(task));
+	}
+	m_Wakeup.notify_one();
+}
+
+void Executor::WorkerLoop()
+{
+	// FatalError needs an env, a thread which can't attach or get a frame just stops taking tasks
+	JNIEnv* env = AttachCurrentThread();
+	if (!env)
+		return;
+	if (env->PushLocalFrame(m_LocalFrameCapacity) != 0)
+	{
+		env->ExceptionClear();
+		DetachCurrentThread();
+		return;
+	}
+
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_Lock);
+			while (m_Tasks.empty() && !m_Stopping)
+				m_Wakeup.wait(lock);
+			if (m_Tasks.empty())
+				break;
+			task = std::move(m_Tasks.front());
+			m_Tasks.pop_front();
+		}
+
+		task();
+
+		// Nobody on this thread can look at the error state, don't let it leak into the next task
+		if (env->ExceptionCheck())
+		{
+			env->ExceptionDescribe();
+			env->ExceptionClear();
+		}
+		CheckError();
+
+		env->PopLocalFrame(NULL);
+		if (env->PushLocalFrame(m_LocalFrameCapacity) != 0)
+		{
+			env->ExceptionClear();
+			DetachCurrentThread();
+			return;
+		}
+	}
+
+	env->PopLocalFrame(NULL);
+	DetachCurrentThread();
+}
+
+}
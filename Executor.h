@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "JNIBridge.h"
+
+namespace jni
+{
+
+// Fixed set of threads which stay attached to the VM for their whole lifetime.
+// Every task runs in a fresh local frame which is popped once it returns, so only
+// values holding global refs (generated API types, jni::Ref) may escape through the future.
+// A thread which fails to attach or to push its frame exits, the others keep running the queue.
+class Executor
+{
+public:
+	explicit Executor(unsigned nThreads = 1, jint localFrameCapacity = 64);
+	~Executor();
+
+	template <typename F>
+	auto Submit(F&& function) -> std::future<decltype(function())>
+	{
+		typedef decltype(function()) R;
+		std::shared_ptr< std::packaged_task<R()> > task = std::make_shared< std::packaged_task<R()> >(std::forward<F>(function));
+		std::future<R> result = task->get_future();
+		Enqueue([task]() { (*task)(); });
+		return result;
+	}
+
+	unsigned GetThreadCount() const { return static_cast<unsigned>(m_Threads.size()); }
+
+private:
+	Executor(const Executor&);
+	Executor& operator = (const Executor&);
+
+	void Enqueue(std::function<void()> task);
+	void WorkerLoop();
+
+	jint m_LocalFrameCapacity;
+	std::vector<std::thread> m_Threads;
+	std::deque< std::function<void()> > m_Tasks;
+	std::mutex m_Lock;
+	std::condition_variable m_Wakeup;
+	bool m_Stopping;
+};
+
+}
@@ -1,4 +1,7 @@
 #include "JNIBridge.h"
+#include "UTF16.h"
+#include <atomic>
+#include <limits>
 #include <stdlib.h>
 #include <string.h>
 #ifdef WINDOWS
@@ -11,33 +14,35 @@ namespace jni
 {
 
 // __thread is not supported on android (dynamic linker) :(
+// Destructor is called with the thread's value when a thread exits, unless the value is NULL
 #if WINDOWS
-	template <typename T>
+	template <typename T, void (*Destructor)(void*) = free>
 	class TLS
 	{
 	public:
-		TLS() { m_Key = TlsAlloc(); }
-		~TLS() { TlsFree(m_Key); }
-		inline operator T () const { return static_cast<T>(TlsGetValue(m_Key)); }
-		inline T operator = (const T value) { TlsSetValue(m_Key, value); return value; }
+		TLS() { m_Key = FlsAlloc(&Callback); }
+		~TLS() { FlsFree(m_Key); }
+		inline operator T () const { return static_cast<T>(FlsGetValue(m_Key)); }
+		inline T operator = (const T value) { FlsSetValue(m_Key, value); return value; }
 	private:
 		TLS(const TLS& tls);
-		TLS<T> operator = (const TLS<T>&);
+		TLS<T, Destructor> operator = (const TLS<T, Destructor>&);
+		static VOID WINAPI Callback(PVOID value) { if (value) Destructor(value); }
 	private:
 		DWORD m_Key;
 	};
 #else
-	template <typename T>
+	template <typename T, void (*Destructor)(void*) = free>
 	class TLS
 	{
 	public:
-		TLS()  { pthread_key_create(&m_Key, free); }
+		TLS()  { pthread_key_create(&m_Key, Destructor); }
 		~TLS() { pthread_key_delete(m_Key); }
 		inline operator T () const { return static_cast<T>(pthread_getspecific(m_Key)); }
 		inline T operator = (const T value) { pthread_setspecific(m_Key, value); return value; }
 	private:
 		TLS(const TLS& tls);
-		TLS<T> operator = (const TLS<T>&);
+		TLS<T, Destructor> operator = (const TLS<T, Destructor>&);
 	private:
 		pthread_key_t m_Key;
 	};
@@ -46,6 +51,23 @@ namespace jni
 static JavaVM*              g_JavaVM;
 static CallbackOverrides    g_Overrides;
 
+// --------------------------------------------------------------------------------------
+// Attach policy
+// --------------------------------------------------------------------------------------
+static std::atomic<int>     g_AttachPolicy(kJNI_ATTACH_SCOPED);
+
+static void NoDestructor(void*) {}
+static void DetachOnThreadExit(void*)
+{
+	if (JavaVM* vm = g_JavaVM)
+		vm->DetachCurrentThread();
+}
+
+// Threads store policy + 1 so that NULL means "follow the global policy"
+static TLS<void*, NoDestructor>         g_ThreadAttachPolicy;
+// Set on threads AttachCurrentThread attached under kJNI_ATTACH_STICKY
+static TLS<void*, DetachOnThreadExit>   g_StickyAttached;
+
 jobject kNull(0);
 
 // --------------------------------------------------------------------------------------
@@ -233,6 +255,24 @@ JNIEnv* GetEnv()
 	return env;
 }
 
+void SetAttachPolicy(AttachPolicy policy)
+{
+	g_AttachPolicy.store(policy == kJNI_ATTACH_DEFAULT ? kJNI_ATTACH_SCOPED : policy, std::memory_order_relaxed);
+}
+
+void SetThreadAttachPolicy(AttachPolicy policy)
+{
+	g_ThreadAttachPolicy = policy == kJNI_ATTACH_DEFAULT ? NULL : reinterpret_cast<void*>(static_cast<uintptr_t>(policy) + 1);
+}
+
+AttachPolicy GetAttachPolicy()
+{
+	uintptr_t threadPolicy = reinterpret_cast<uintptr_t>(static_cast<void*>(g_ThreadAttachPolicy));
+	if (threadPolicy)
+		return static_cast<AttachPolicy>(threadPolicy - 1);
+	return static_cast<AttachPolicy>(g_AttachPolicy.load(std::memory_order_relaxed));
+}
+
 JNIEnv* AttachCurrentThread()
 {
 	JavaVM* vm = g_JavaVM;
@@ -251,6 +291,8 @@ JNIEnv* AttachCurrentThread()
 	#else
 		vm->AttachCurrentThread(&env, &args);
 	#endif
+		if (env && GetAttachPolicy() == kJNI_ATTACH_STICKY)
+			g_StickyAttached = reinterpret_cast<void*>(1);
 	}
 
 	if (!env)
@@ -265,6 +307,7 @@ void DetachCurrentThread()
 	if (!vm)
 		return;
 
+	g_StickyAttached = NULL;
 	vm->DetachCurrentThread();
 }
 
@@ -377,6 +420,30 @@ jstring NewStringUTF(const char* str)
 	JNI_CALL_RETURN(jstring, str, true, env->NewStringUTF(str));
 }
 
+jstring NewString(const jchar* unicode, jsize length)
+{
+	JNI_CALL_RETURN(jstring, unicode || !length, true, env->NewString(unicode, length));
+}
+
+jstring NewStringUTF8(const char* str, size_t length)
+{
+	if (CheckForParameterError((str || !length) && length <= static_cast<size_t>(std::numeric_limits<jsize>::max())))
+		return 0;
+
+	// Short strings (log lines, JSON fragments) are transcoded on the stack
+	jchar stackBuffer[512];
+	jchar* buffer = length <= sizeof(stackBuffer) / sizeof(stackBuffer[0]) ? stackBuffer : static_cast<jchar*>(malloc(length * sizeof(jchar)));
+	if (!buffer)
+	{
+		SetError(kJNI_EXCEPTION_THROWN, "java.lang.OutOfMemoryError: Unable to allocate the UTF-16 buffer");
+		return 0;
+	}
+	jstring result = NewString(buffer, static_cast<jsize>(Utf8ToUtf16(str, length, buffer)));
+	if (buffer != stackBuffer)
+		free(buffer);
+	return result;
+}
+
 jsize GetStringUTFLength(jstring string)
 {
 	JNI_CALL_RETURN(jsize, string, true, env->GetStringUTFLength(string));
@@ -422,6 +489,11 @@ void ReleasePrimitiveArrayCritical(jarray obj, void *carray, jint mode)
 	JNI_CALL(obj, false, env->ReleasePrimitiveArrayCritical(obj, carray, mode));
 }
 
+bool RegisterNatives(jclass clazz, const JNINativeMethod* methods, jint nMethods)
+{
+	JNI_CALL_RETURN(bool, clazz && methods, true, env->RegisterNatives(clazz, methods, nMethods) == JNI_OK);
+}
+
 jobject NewDirectByteBuffer(void* buffer, jlong size)
 {
 	JNI_CALL_RETURN(jobject, buffer, true, env->NewDirectByteBuffer(buffer, size));
@@ -449,8 +521,13 @@ LocalScope::LocalScope()
 		m_Env = AttachCurrentThread();
 		if (nullptr == m_Env)
 			FatalError("Failed to attach thread to Java");
-		else
+		else if (GetAttachPolicy() != kJNI_ATTACH_STICKY)
 			m_ScopeState = kStateAttachedThread;
+		// Sticky threads stay attached, so locals need a frame of their own
+		else if (0 == PushLocalFrame(kLocalFrameCapacity))
+			m_ScopeState = kStatePushedFrame;
+		else
+			FatalError("Out of memory: Unable to allocate local frame");
 	}
 	else if (0 == PushLocalFrame(kLocalFrameCapacity))
 		m_ScopeState = kStatePushedFrame;
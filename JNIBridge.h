@@ -1,4 +1,5 @@
 #pragma once
+#include <assert.h>
 #include <stdint.h>
 #include <jni.h>
 #if 0 // ANDROID
@@ -27,8 +28,27 @@ enum Errno
 	kJNI_EXCEPTION_THROWN
 };
 
+enum AttachPolicy
+{
+	kJNI_ATTACH_DEFAULT = 0,	// SetThreadAttachPolicy only: follow the global policy
+	kJNI_ATTACH_SCOPED,			// LocalScope detaches threads it had to attach (default)
+	kJNI_ATTACH_STICKY			// threads stay attached until they exit
+};
+
 extern jobject kNull;
 
+// Outcome of a TryCall* operation, checked right where the call returns instead of through CheckError.
+// A thrown exception is taken over as a local ref and cleared, the thread's error state is left alone.
+template <typename T>
+struct Result
+{
+	T          value;
+	Errno      error;
+	jthrowable exception;
+
+	inline operator bool() const { return error == kJNI_NO_ERROR; }
+};
+
 // --------------------------------------------------------------------------------------
 // Initialization and error functions
 // --------------------------------------------------------------------------------------
@@ -39,6 +59,10 @@ Errno       CheckError();
 Errno       PeekError();
 const char* GetErrorMessage();
 
+void        SetAttachPolicy(AttachPolicy policy);
+void        SetThreadAttachPolicy(AttachPolicy policy);
+AttachPolicy GetAttachPolicy();
+
 jthrowable  ExceptionThrown(jclass clazz = 0);
 
 // Internalish
@@ -82,6 +106,9 @@ jobject      ToReflectedMethod(jclass clazz, jmethodID methodID, bool isStatic);
 jobject		 NewObject(jclass clazz, jmethodID methodID, ...);
 
 jstring      NewStringUTF(const char* str);
+jstring      NewString(const jchar* unicode, jsize length);
+// Takes standard UTF-8 by length, no terminating NUL needed, and goes through NewString (see UTF16.h)
+jstring      NewStringUTF8(const char* str, size_t length);
 jsize        GetStringUTFLength(jstring string);
 const char*  GetStringUTFChars(jstring str, jboolean* isCopy = 0);
 void         ReleaseStringUTFChars(jstring str, const char* utfchars);
@@ -93,6 +120,8 @@ void*        GetPrimitiveArrayCritical(jarray obj, jboolean *isCopy);
 void         ReleasePrimitiveArrayCritical(jarray obj, void *carray, jint mode);
 jobjectArray NewObjectArray(jsize length, jclass elementClass, jobject initialElement = 0);
 
+bool         RegisterNatives(jclass clazz, const JNINativeMethod* methods, jint nMethods);
+
 jobject      NewDirectByteBuffer(void* buffer, jlong size);
 void*        GetDirectBufferAddress(jobject byteBuffer);
 jlong        GetDirectBufferCapacity(jobject byteBuffer);
@@ -164,6 +193,57 @@ typedef LocalScope LocalFrame;
 			result = 0;                                                                                 \
 	}
 
+// Unchecked calls are for methods known not to throw (see APIGenerator --nocheck), they skip the exception
+// checks, which cost a VM transition each, but keep the parameter check, which doesn't.
+// Debug builds assert the assumption instead, JNI_ASSERT_UNCHECKED=0 turns that off.
+#if !defined(JNI_ASSERT_UNCHECKED)
+#	if defined(NDEBUG)
+#		define JNI_ASSERT_UNCHECKED 0
+#	else
+#		define JNI_ASSERT_UNCHECKED 1
+#	endif
+#endif
+
+#if JNI_ASSERT_UNCHECKED
+#	define JNI_UNCHECKED_ASSERT(condition) assert(condition)
+#else
+#	define JNI_UNCHECKED_ASSERT(condition) do {} while (false)
+#endif
+
+// A pending exception that isn't ours is reported as kJNI_EXCEPTION_THROWN without a throwable, and stays pending
+#define JNI_TRY_CALL_RETURN(type, parameters, function)                                                 \
+	JNI_TRACE("%d:try:%s %s", static_cast<bool>(parameters), #type, #function);                         \
+	Result<type> JNI_CALL_result = { 0, kJNI_NO_ERROR, 0 };                                             \
+	JNIEnv* env(AttachCurrentThread());                                                                 \
+	if (!env)                                                                                           \
+		JNI_CALL_result.error = kJNI_ATTACH_FAILED;                                                     \
+	else if (!(parameters))                                                                             \
+		JNI_CALL_result.error = kJNI_INVALID_PARAMETERS;                                                \
+	else if (env->ExceptionCheck())                                                                     \
+		JNI_CALL_result.error = kJNI_EXCEPTION_THROWN;                                                  \
+	else                                                                                                \
+	{                                                                                                   \
+		JNI_CALL_result.value = function;                                                               \
+		if (env->ExceptionCheck())                                                                      \
+		{                                                                                               \
+			JNI_CALL_result.value = 0;                                                                  \
+			JNI_CALL_result.error = kJNI_EXCEPTION_THROWN;                                              \
+			JNI_CALL_result.exception = env->ExceptionOccurred();                                       \
+			env->ExceptionClear();                                                                      \
+		}                                                                                               \
+	}                                                                                                   \
+	return JNI_CALL_result
+
+#define JNI_CALL_UNCHECKED_RETURN(type, parameters, function)                                           \
+	JNI_TRACE("%d:unchecked:%s %s", static_cast<bool>(parameters), #type, #function);                   \
+	JNIEnv* env(AttachCurrentThread());                                                                 \
+	if (!env || CheckForParameterError(parameters))                                                     \
+		return 0;                                                                                       \
+	JNI_UNCHECKED_ASSERT(!env->ExceptionCheck());                                                       \
+	type JNI_CALL_result = function;                                                                    \
+	JNI_UNCHECKED_ASSERT(!env->ExceptionCheck());                                                       \
+	return JNI_CALL_result
+
 
 //----------------------------------------------------------------------------
 // JNI Operations
@@ -183,11 +263,43 @@ template <typename JT, typename RT,
 class MethodOps
 {
 public:
+	static JT CallMethodV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_CALL_RETURN(JT, object && id, true, static_cast<JT>((env->*CallMethodOP)(object, id, args)));
+	}
+	static JT CallNonVirtualMethodV(jobject object, jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL_RETURN(JT, object && clazz && id, true, static_cast<JT>((env->*CallNonvirtualMethodOP)(object, clazz, id, args)));
+	}
+	static JT CallStaticMethodV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL_RETURN(JT, clazz && id, true, static_cast<JT>((env->*CallStaticMethodOP)(clazz, id, args)));
+	}
+	static JT CallMethodUncheckedV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_CALL_UNCHECKED_RETURN(JT, object && id, static_cast<JT>((env->*CallMethodOP)(object, id, args)));
+	}
+	static Result<JT> TryCallMethodV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_TRY_CALL_RETURN(JT, object && id, static_cast<JT>((env->*CallMethodOP)(object, id, args)));
+	}
+	static Result<JT> TryCallNonVirtualMethodV(jobject object, jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_TRY_CALL_RETURN(JT, object && clazz && id, static_cast<JT>((env->*CallNonvirtualMethodOP)(object, clazz, id, args)));
+	}
+	static Result<JT> TryCallStaticMethodV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_TRY_CALL_RETURN(JT, clazz && id, static_cast<JT>((env->*CallStaticMethodOP)(clazz, id, args)));
+	}
+	static JT CallStaticMethodUncheckedV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL_UNCHECKED_RETURN(JT, clazz && id, static_cast<JT>((env->*CallStaticMethodOP)(clazz, id, args)));
+	}
 	static JT CallMethod(jobject object, jmethodID id, ...)
 	{
 		va_list args;
 		va_start(args, id);
-		JNI_CALL_DECLARE(JT, result, object && id, true, static_cast<JT>((env->*CallMethodOP)(object, id, args)));
+		JT result = CallMethodV(object, id, args);
 		va_end(args);
 		return result;
 	}
@@ -195,7 +307,7 @@ public:
 	{
 		va_list args;
 		va_start(args, id);
-		JNI_CALL_DECLARE(JT, result, object && clazz && id, true, static_cast<JT>((env->*CallNonvirtualMethodOP)(object, clazz, id, args)));
+		JT result = CallNonVirtualMethodV(object, clazz, id, args);
 		va_end(args);
 		return result;
 	}
@@ -203,7 +315,47 @@ public:
 	{
 		va_list args;
 		va_start(args, id);
-		JNI_CALL_DECLARE(JT, result, clazz && id, true, static_cast<JT>((env->*CallStaticMethodOP)(clazz, id, args)));
+		JT result = CallStaticMethodV(clazz, id, args);
+		va_end(args);
+		return result;
+	}
+	static JT CallMethodUnchecked(jobject object, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		JT result = CallMethodUncheckedV(object, id, args);
+		va_end(args);
+		return result;
+	}
+	static JT CallStaticMethodUnchecked(jclass clazz, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		JT result = CallStaticMethodUncheckedV(clazz, id, args);
+		va_end(args);
+		return result;
+	}
+	static Result<JT> TryCallMethod(jobject object, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		Result<JT> result = TryCallMethodV(object, id, args);
+		va_end(args);
+		return result;
+	}
+	static Result<JT> TryCallNonVirtualMethod(jobject object, jclass clazz, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		Result<JT> result = TryCallNonVirtualMethodV(object, clazz, id, args);
+		va_end(args);
+		return result;
+	}
+	static Result<JT> TryCallStaticMethod(jclass clazz, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		Result<JT> result = TryCallStaticMethodV(clazz, id, args);
 		va_end(args);
 		return result;
 	}
@@ -404,11 +556,54 @@ template <>
 class Op<jvoid>
 {
 public:
+	static jvoid CallMethodV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_CALL(object && id, true, env->CallVoidMethodV(object, id, args));
+		return 0;
+	}
+	static jvoid CallNonVirtualMethodV(jobject object, jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL(object && clazz && id, true, env->CallNonvirtualVoidMethodV(object, clazz, id, args));
+		return 0;
+	}
+	static jvoid CallStaticMethodV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL(clazz && id, true, env->CallStaticVoidMethodV(clazz, id, args));
+		return 0;
+	}
+	static jvoid CallMethodUncheckedV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_CALL_UNCHECKED_RETURN(jvoid, object && id, (env->CallVoidMethodV(object, id, args), jvoid(0)));
+	}
+	static jvoid CallStaticMethodUncheckedV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL_UNCHECKED_RETURN(jvoid, clazz && id, (env->CallStaticVoidMethodV(clazz, id, args), jvoid(0)));
+	}
+	static Result<jvoid> TryCallMethodV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_TRY_CALL_RETURN(jvoid, object && id, (env->CallVoidMethodV(object, id, args), jvoid(0)));
+	}
+	static Result<jvoid> TryCallNonVirtualMethodV(jobject object, jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_TRY_CALL_RETURN(jvoid, object && clazz && id, (env->CallNonvirtualVoidMethodV(object, clazz, id, args), jvoid(0)));
+	}
+	static Result<jvoid> TryCallStaticMethodV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_TRY_CALL_RETURN(jvoid, clazz && id, (env->CallStaticVoidMethodV(clazz, id, args), jvoid(0)));
+	}
 	static jvoid CallMethod(jobject object, jmethodID id, ...)
 	{
 		va_list args;
 		va_start(args, id);
-		JNI_CALL(object && id, true, env->CallVoidMethodV(object, id, args));
+		CallMethodV(object, id, args);
+		va_end(args);
+		return 0;
+	}
+	static jvoid CallNonVirtualMethod(jobject object, jclass clazz, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		CallNonVirtualMethodV(object, clazz, id, args);
 		va_end(args);
 		return 0;
 	}
@@ -416,10 +611,50 @@ public:
 	{
 		va_list args;
 		va_start(args, id);
-		JNI_CALL(clazz && id, true, env->CallStaticVoidMethodV(clazz, id, args));
+		CallStaticMethodV(clazz, id, args);
+		va_end(args);
+		return 0;
+	}
+	static jvoid CallMethodUnchecked(jobject object, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		CallMethodUncheckedV(object, id, args);
+		va_end(args);
+		return 0;
+	}
+	static jvoid CallStaticMethodUnchecked(jclass clazz, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		CallStaticMethodUncheckedV(clazz, id, args);
 		va_end(args);
 		return 0;
 	}
+	static Result<jvoid> TryCallMethod(jobject object, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		Result<jvoid> result = TryCallMethodV(object, id, args);
+		va_end(args);
+		return result;
+	}
+	static Result<jvoid> TryCallNonVirtualMethod(jobject object, jclass clazz, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		Result<jvoid> result = TryCallNonVirtualMethodV(object, clazz, id, args);
+		va_end(args);
+		return result;
+	}
+	static Result<jvoid> TryCallStaticMethod(jclass clazz, jmethodID id, ...)
+	{
+		va_list args;
+		va_start(args, id);
+		Result<jvoid> result = TryCallStaticMethodV(clazz, id, args);
+		va_end(args);
+		return result;
+	}
 };
 
 }
@@ -28,7 +28,7 @@ using System.Linq;
  *   - build:android:x86_64
  *   - build:android:zip - builds all 4 android archs above and zips them (THIS IS THE MAIN ONE)
  *   - build:osx:x86_64
- *   - build:osx:test - builds the one above and the test program (run ./build/osx/test afterwards to run tests)
+ *   - build:osx:test - builds the one above, the test program and build/osx/jnibridge-test.jar (run ./build/osx/test afterwards to run tests)
  *   - build:windows:x86_64
  *   - build:windows:test - builds the one above and the test program (run build\windows\runtests.cmd afterwards to run tests)
  *   - projectfiles - generates IDE projects
@@ -120,6 +120,20 @@ class JniBridge
     {
         "::java::lang::System",
         "::java::lang::UnsupportedOperationException",
+        "::java::util::concurrent::Callable",
+    };
+
+    // Exercised by the stub proxy test, so the NativeStub_* path gets compiled and run
+    private static readonly string[] kDesktopStubInterfaces = new[]
+    {
+        "::java::lang::Runnable",
+        "::java::util::concurrent::Callable",
+    };
+
+    // Opt-in features the test program covers, the library and the tests have to agree on them
+    private static readonly string[] kTestDefines = new[]
+    {
+        "ENABLE_PROXY_STATISTICS",
     };
 
     private static NPath[] HeaderFiles => NPath.CurrentDirectory.Files("*.h");
@@ -165,12 +179,14 @@ class JniBridge
         var osxToolchain = ToolChain.Store.Mac().Sdk_10_13().x64();
         var osxConfig = new NativeProgramConfiguration(codegenForTests, osxToolchain, false);
         var osxStaticLib = SetupJniBridgeStaticLib(generatedFilesMacOS, osxConfig, GetMacOSStaticLibParams(osxToolchain, jdk));
-        SetupTestProgramOsx(osxToolchain, osxStaticLib, codegenForTests, generatedFilesMacOS, jdk);
+        var osxTestJar = SetupTestJar(jdk, generatedFilesMacOS, GetMacOSSourceGenerationParams(jdk));
+        SetupTestProgramOsx(osxToolchain, osxStaticLib, codegenForTests, generatedFilesMacOS, jdk, osxTestJar);
 
         var windowsToolchain = ToolChain.Store.Windows().VS2019().Sdk_18362().x64();
         var windowsConfig = new NativeProgramConfiguration(codegenForTests, windowsToolchain, false);
         var windowsStaticLib = SetupJniBridgeStaticLib(generatedFilesWindows, windowsConfig, GetWindowsStaticLibParams(windowsToolchain, jdk));
-        var windowsTestProgram = SetupTestProgramWindows(windowsToolchain, windowsStaticLib, codegenForTests, generatedFilesWindows, jdk,
+        var windowsTestJar = SetupTestJar(jdk, generatedFilesWindows, GetWindowsSourceGenerationParams(jdk));
+        var windowsTestProgram = SetupTestProgramWindows(windowsToolchain, windowsStaticLib, codegenForTests, generatedFilesWindows, jdk, windowsTestJar,
             out var targetExecutable, out var arguments, out var workingDirectory);
 
         var androidZipPath = "build/jnibridge-android.7z";
@@ -259,6 +275,17 @@ class JniBridge
         public string platformName;
         public NPath[] inputJars;
         public string[] classes;
+        public string[] stubInterfaces;
+        public string[] snapshotClasses;
+        public NPath[] usagePaths;
+        // Regexes over <class>.<method>, one per line, of methods that can't throw and are called without exception checks
+        public NPath noCheckFile;
+        // Inline wrappers live in <class>.inl.h (API.h includes them), which callers have to include instead of <class>.h
+        public bool inlineMembers;
+        // Methods call through a per-class descriptor table instead of carrying their own jmethodID lookup
+        public bool compactMethods;
+        // Number of translation units all classes are implemented in, 0 for one per class
+        public int unityFiles;
     }
 
     static SourceGenerationParams GetAndroidSourceGenerationParams(NPath sdk, NPath gps)
@@ -271,6 +298,7 @@ class JniBridge
             platformName = "android",
             inputJars = new[] {androidJar, googlePlayServicesJar},
             classes = kAndroidApiClasses,
+            snapshotClasses = new[] {"::android::graphics::Rect", "::android::graphics::RectF", "::android::util::DisplayMetrics"},
         };
     }
 
@@ -281,6 +309,7 @@ class JniBridge
             platformName = platformName,
             inputJars = Array.Empty<NPath>(),
             classes = kDesktopClasses,
+            stubInterfaces = kDesktopStubInterfaces,
         };
     }
 
@@ -294,11 +323,28 @@ class JniBridge
         return GetDesktopSourceGenerationParams(jdk, Platform.Windows);
     }
 
+    static NPath GetGeneratedDir(SourceGenerationParams genParams)
+    {
+        return new NPath("artifacts").Combine("generated", genParams.platformName);
+    }
+
+    // NativeStub_* sources of the stub interfaces given by plain class name, regexes can't be mapped to files up front
+    static NPath[] GetGeneratedStubFiles(SourceGenerationParams genParams)
+    {
+        if (genParams.stubInterfaces == null)
+            return Array.Empty<NPath>();
+        var stubDir = GetGeneratedDir(genParams).Combine("java", "bitter", "jnibridge");
+        return genParams.stubInterfaces
+            .Where(name => name.All(c => char.IsLetterOrDigit(c) || c == '_' || c == ':'))
+            .Select(name => stubDir.Combine("NativeStub_" + name.TrimStart(':').Replace("::", "_") + ".java"))
+            .ToArray();
+    }
+
     static NPath SetupSourceGeneration(Jdk jdk, NPath apiGenerator, NPath jnibridgeJar, SourceGenerationParams genParams)
     {
-        var destDir = new NPath("artifacts").Combine("generated", genParams.platformName);
+        var destDir = GetGeneratedDir(genParams);
         var actionName = "generate:jnibridge:" + genParams.platformName;
-        var generatedFiles = new NPath[] { destDir.Combine("API.h") };
+        var generatedFiles = new[] { destDir.Combine("API.h") }.Concat(GetGeneratedStubFiles(genParams)).ToArray();
 
         var templateFiles = new NPath("templates").Files(new [] { "cpp", "h" });
         var inputs = new List<NPath>();
@@ -323,7 +369,33 @@ class JniBridge
             inputJars = "-s";
         }
         var apiClassString = string.Join(" ", genParams.classes);
-        
+
+        // Interfaces listed here also get a NativeStub_* class in <destDir>/java, which has to be compiled into the app
+        string stubOption = string.Empty;
+        if (genParams.stubInterfaces != null && genParams.stubInterfaces.Length > 0)
+            stubOption = "--stubs \"" + string.Join(";", genParams.stubInterfaces) + '"';
+
+        // Classes listed here get a Snapshot struct with bulk __Read/__Write of their public primitive fields
+        string snapshotOption = string.Empty;
+        if (genParams.snapshotClasses != null && genParams.snapshotClasses.Length > 0)
+            snapshotOption = "--snapshot \"" + string.Join(";", genParams.snapshotClasses) + '"';
+
+        // Only members named in these manifests/sources (and in jnibridge itself) get generated, the rest become opaque
+        string usageOption = string.Empty;
+        if (genParams.usagePaths != null && genParams.usagePaths.Length > 0)
+        {
+            var usageFiles = genParams.usagePaths.Concat(HeaderFiles).Concat(CppFiles).ToArray();
+            inputs.AddRange(usageFiles.Where(f => f.FileExists()));
+            usageOption = "--usage \"" + string.Join(";", usageFiles.Select(f => f.ToString())) + '"';
+        }
+
+        string noCheckOption = string.Empty;
+        if (genParams.noCheckFile != null)
+        {
+            inputs.Add(genParams.noCheckFile);
+            noCheckOption = "--nocheck " + genParams.noCheckFile.InQuotes();
+        }
+
         Backend.Current.AddAction(
             actionName,
             generatedFiles,
@@ -335,6 +407,13 @@ class JniBridge
                 apiGenerator.InQuotes(),
                 "APIGenerator",
                 destDir.InQuotes(),
+                stubOption,
+                snapshotOption,
+                usageOption,
+                noCheckOption,
+                genParams.inlineMembers ? "--inline" : string.Empty,
+                genParams.compactMethods ? "--compact" : string.Empty,
+                genParams.unityFiles > 0 ? "--unity " + genParams.unityFiles : string.Empty,
                 inputJars,
                 apiClassString
             },
@@ -386,6 +465,7 @@ class JniBridge
             {
                 np.IncludeDirectories.Add(jdk.JavaHome.Combine("include"));
                 np.IncludeDirectories.Add(jdk.JavaHome.Combine("include", "darwin"));
+                np.Defines.Add(kTestDefines);
             },
         };
     }
@@ -401,6 +481,7 @@ class JniBridge
             {
                 np.IncludeDirectories.Add(jdk.JavaHome.Combine("include"));
                 np.IncludeDirectories.Add(jdk.JavaHome.Combine("include", "win32"));
+                np.Defines.Add(kTestDefines);
             },
         };
     }
@@ -443,7 +524,14 @@ class JniBridge
         var includeFiles = new List<NPath>();
         var includes = new NPath("build").Combine(platformName, "include", "jnibridge");
 
-        includeFiles.Add(Backend.Current.SetupCopyFile(includes.Combine("API.h"), generatedFilesDir.Combine("API.h")));
+        // API.h only includes the per class headers, which all have to be shipped next to it
+        NPath[] generatedHeaders;
+        if (!generatedFilesDir.DirectoryExists())
+            generatedHeaders = new[] {generatedFilesDir.Combine("API.h")};
+        else
+            generatedHeaders = generatedFilesDir.Files("*.h");
+        foreach (var file in generatedHeaders)
+            includeFiles.Add(Backend.Current.SetupCopyFile(includes.Combine(file.FileName), file));
         foreach (var file in HeaderFiles)
             includeFiles.Add(Backend.Current.SetupCopyFile(includes.Combine(file.FileName), file));
 
@@ -452,10 +540,24 @@ class JniBridge
         return incs;
     }
 
-    static void SetupTestProgramOsx(ToolChain toolchain, NativeProgram staticLib, CodeGen codegen, NPath generatedFilesDir, Jdk jdk)
+    // jnibridge.jar plus the generated NativeStub_* classes, which have to live in the same package and class loader
+    static NPath SetupTestJar(Jdk jdk, NPath generatedFilesDir, SourceGenerationParams genParams)
+    {
+        var jnibridgeDir = new NPath("jnibridge");
+        var stubDir = generatedFilesDir.Combine("java");
+        var sources = jnibridgeDir.Files("*.java", true).Concat(GetGeneratedStubFiles(genParams)).ToArray();
+        var classFileDir = new NPath($"artifacts/jnibridge-test/{genParams.platformName}");
+        var testJar = new NPath("build").Combine(genParams.platformName, "jnibridge-test.jar");
+        var classFiles = jdk.SetupCompilation(classFileDir, sources, new NPath[] { jnibridgeDir, stubDir }, new NPath[0], targetVersion: "11");
+        jdk.SetupJar(new NPath[] { classFileDir }, classFiles, testJar);
+        return testJar;
+    }
+
+    static void SetupTestProgramOsx(ToolChain toolchain, NativeProgram staticLib, CodeGen codegen, NPath generatedFilesDir, Jdk jdk, NPath testJar)
     {
         var np = new NativeProgram("JNIBridgeTests");
         np.Sources.Add(new NPath("test").Files("*.cpp"));
+        np.Defines.Add(kTestDefines);
         np.IncludeDirectories.Add(generatedFilesDir);
         np.IncludeDirectories.Add(jdk.JavaHome.Combine("include"));
         np.IncludeDirectories.Add(jdk.JavaHome.Combine("include", "darwin"));
@@ -468,13 +570,14 @@ class JniBridge
         var config = new NativeProgramConfiguration(codegen, toolchain, false);
         var target = np.SetupSpecificConfiguration(config, config.ToolChain.ExecutableFormat).DeployTo(destDir);
         
-        Backend.Current.AddAliasDependency($"build:{Platform.OSX}:test", target.Paths);
+        Backend.Current.AddAliasDependency($"build:{Platform.OSX}:test", target.Paths.Append(testJar).ToArray());
     }
 
-    static NativeProgram SetupTestProgramWindows(ToolChain toolchain, NativeProgram staticLib, CodeGen codegen, NPath generatedFilesDir, Jdk jdk, out NPath targetExecutable, out string arguments, out NPath workingDirectory)
+    static NativeProgram SetupTestProgramWindows(ToolChain toolchain, NativeProgram staticLib, CodeGen codegen, NPath generatedFilesDir, Jdk jdk, NPath testJar, out NPath targetExecutable, out string arguments, out NPath workingDirectory)
     {
         var np = new NativeProgram("JNIBridgeTests");
         np.Sources.Add(new NPath("test").Files("*.cpp"));
+        np.Defines.Add(kTestDefines);
         np.IncludeDirectories.Add(generatedFilesDir);
         np.IncludeDirectories.Add(jdk.JavaHome.Combine("include"));
         np.IncludeDirectories.Add(jdk.JavaHome.Combine("include", "win32"));
@@ -488,7 +591,7 @@ class JniBridge
 
         workingDirectory = jdk.JavaHome.Combine("bin", "server").MakeAbsolute();
         targetExecutable = destDir.Combine(np.Name + ".exe").MakeAbsolute();
-        arguments = "build/jnibridge.jar".ToNPath().MakeAbsolute().InQuotes();
+        arguments = testJar.MakeAbsolute().InQuotes();
         var script = destDir.Combine("runtests.cmd");
         Backend.Current.AddWriteTextAction(script, $@"echo off
 echo Launching tests
@@ -500,6 +603,7 @@ exit %ERRORLEVEL%
 
         var targetPaths = new List<NPath>(target.Paths);
         targetPaths.Add(script);
+        targetPaths.Add(testJar);
         Backend.Current.AddAliasDependency($"build:{Platform.Windows}:test", targetPaths.ToArray());
 
         return np;
@@ -0,0 +1,233 @@
+#include "MappedBuffer.h"
+#include "Natives.h"
+#include <atomic>
+#if WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace jni
+{
+
+static jni::Class s_MappedBufferClass("bitter/jnibridge/MappedBuffer");
+static jni::Class s_MappedByteBufferClass("java/nio/ByteBuffer");
+
+// The view starts at an aligned offset, data/size describe the requested range inside it
+struct MappedBuffer::Mapping
+{
+	void* view;
+	size_t viewSize;
+	char* data;
+	jlong size;
+	bool writable;
+	std::atomic<int> refs;
+};
+
+static jlong GetMappingAlignment()
+{
+#if WINDOWS
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static MappedBuffer::Mapping* Map(const char* path, bool writable, jlong offset, jlong length)
+{
+	if (!path || offset < 0)
+		return NULL;
+
+	jlong alignedOffset = offset - offset % GetMappingAlignment();
+	void* view = NULL;
+#if WINDOWS
+	HANDLE file = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+		fileSize.QuadPart = 0;
+	if (length < 0)
+		length = fileSize.QuadPart - offset;
+	if (length > 0 && offset + length <= fileSize.QuadPart)
+	{
+		// The mapping object and file handle can go right away, the view keeps them alive
+		HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+		{
+			view = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, static_cast<DWORD>(alignedOffset >> 32), static_cast<DWORD>(alignedOffset), static_cast<SIZE_T>(offset - alignedOffset + length));
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+		info.st_size = 0;
+	if (length < 0)
+		length = info.st_size - offset;
+	if (length > 0 && offset + length <= info.st_size)
+	{
+		// The descriptor can be closed right away, the mapping keeps the file open
+		view = mmap(NULL, static_cast<size_t>(offset - alignedOffset + length), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, static_cast<off_t>(alignedOffset));
+		if (view == MAP_FAILED)
+			view = NULL;
+	}
+	close(fd);
+#endif
+	if (!view)
+		return NULL;
+
+	MappedBuffer::Mapping* mapping = new MappedBuffer::Mapping();
+	mapping->view = view;
+	mapping->viewSize = static_cast<size_t>(offset - alignedOffset + length);
+	mapping->data = static_cast<char*>(view) + (offset - alignedOffset);
+	mapping->size = length;
+	mapping->writable = writable;
+	mapping->refs = 1;
+	return mapping;
+}
+
+static void Retain(MappedBuffer::Mapping* mapping)
+{
+	if (mapping)
+		mapping->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void Release(MappedBuffer::Mapping* mapping)
+{
+	if (!mapping || mapping->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+#if WINDOWS
+	UnmapViewOfFile(mapping->view);
+#else
+	munmap(mapping->view, mapping->viewSize);
+#endif
+	delete mapping;
+}
+
+// Called by the first close() of a Java owner from NewJavaObject
+static void ReleaseMapping(JNIEnv* env, jclass clazz, jlong handle)
+{
+	Release(reinterpret_cast<MappedBuffer::Mapping*>(handle));
+}
+
+MappedBuffer::MappedBuffer(const char* path, Mode mode, jlong offset, jlong length)
+: m_Mapping(Map(path, mode == kReadWrite, offset, length))
+{
+}
+
+MappedBuffer::MappedBuffer(const MappedBuffer& other)
+: m_Mapping(other.m_Mapping)
+{
+	Retain(m_Mapping);
+}
+
+MappedBuffer::MappedBuffer(MappedBuffer&& other)
+: m_Mapping(other.m_Mapping)
+{
+	other.m_Mapping = NULL;
+}
+
+MappedBuffer::~MappedBuffer()
+{
+	Release(m_Mapping);
+}
+
+MappedBuffer& MappedBuffer::operator = (const MappedBuffer& other)
+{
+	Retain(other.m_Mapping);
+	Release(m_Mapping);
+	m_Mapping = other.m_Mapping;
+	return *this;
+}
+
+MappedBuffer& MappedBuffer::operator = (MappedBuffer&& other)
+{
+	if (&other == this)
+		return *this;
+	Release(m_Mapping);
+	m_Mapping = other.m_Mapping;
+	other.m_Mapping = NULL;
+	return *this;
+}
+
+void* MappedBuffer::GetData() const
+{
+	return m_Mapping ? m_Mapping->data : NULL;
+}
+
+jlong MappedBuffer::GetSize() const
+{
+	return m_Mapping ? m_Mapping->size : 0;
+}
+
+jobject MappedBuffer::NewJavaObject() const
+{
+	if (!m_Mapping)
+		return NULL;
+
+	static const jni::NativeMethod natives[] = { JNI_NATIVE_METHOD("release", ReleaseMapping) };
+	static bool registered = jni::RegisterNatives(s_MappedBufferClass, natives, 1);
+	static jmethodID createMID = jni::GetStaticMethodID(s_MappedBufferClass, "create", "(Ljava/nio/ByteBuffer;J)Lbitter/jnibridge/MappedBuffer;");
+	static jmethodID readOnlyMID = jni::GetMethodID(s_MappedByteBufferClass, "asReadOnlyBuffer", "()Ljava/nio/ByteBuffer;");
+	if (!registered)
+		return NULL;
+
+	jobject buffer = jni::NewDirectByteBuffer(m_Mapping->data, m_Mapping->size);
+	if (buffer && !m_Mapping->writable)
+	{
+		// Writing through a buffer over a read-only mapping would crash
+		jobject readOnly = jni::Op<jobject>::CallMethod(buffer, readOnlyMID);
+		jni::DeleteLocalRef(buffer);
+		buffer = readOnly;
+	}
+	if (!buffer)
+		return NULL;
+
+	// The owner's reference is only released by close(), views of the buffer can't tell when they are gone
+	Retain(m_Mapping);
+	jobject owner = jni::Op<jobject>::CallStaticMethod(s_MappedBufferClass, createMID, buffer, reinterpret_cast<jlong>(m_Mapping));
+	jni::DeleteLocalRef(buffer);
+	if (!owner)
+		Release(m_Mapping);
+	return owner;
+}
+
+bool MappedBuffer::Advise(Advice advice, jlong offset, jlong length) const
+{
+	if (!m_Mapping || offset < 0 || offset > m_Mapping->size)
+		return false;
+	if (length < 0 || offset + length > m_Mapping->size)
+		length = m_Mapping->size - offset;
+#if WINDOWS
+	return false;
+#else
+	static const int kAdvice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+	// madvise wants a page aligned start
+	char* start = m_Mapping->data + offset;
+	char* alignedStart = start - (start - static_cast<char*>(m_Mapping->view)) % GetMappingAlignment();
+	return madvise(alignedStart, static_cast<size_t>(start - alignedStart + length), kAdvice[advice]) == 0;
+#endif
+}
+
+bool MappedBuffer::Flush() const
+{
+	if (!m_Mapping || !m_Mapping->writable)
+		return false;
+#if WINDOWS
+	return FlushViewOfFile(m_Mapping->view, m_Mapping->viewSize) != 0;
+#else
+	return msync(m_Mapping->view, m_Mapping->viewSize, MS_SYNC) == 0;
+#endif
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+namespace jni
+{
+
+// A file (or a range of it) mapped into memory, which can be handed to Java APIs as a direct ByteBuffer without copying.
+// Copies share the mapping, it's unmapped once the last MappedBuffer is gone and every Java owner from NewJavaObject is closed.
+class MappedBuffer
+{
+public:
+	enum Mode
+	{
+		kReadOnly,	// the ByteBuffer is read-only as well
+		kReadWrite	// writes from either side go to the file
+	};
+
+	// Access pattern hints, a no-op where the platform has no equivalent (Windows)
+	enum Advice
+	{
+		kAdviceNormal,
+		kAdviceSequential,
+		kAdviceRandom,
+		kAdviceWillNeed,
+		kAdviceDontNeed
+	};
+
+	// length < 0 maps everything from offset to the end of the file, check IsValid for failures
+	explicit MappedBuffer(const char* path, Mode mode = kReadOnly, jlong offset = 0, jlong length = -1);
+	MappedBuffer(const MappedBuffer& other);
+	MappedBuffer(MappedBuffer&& other);
+	~MappedBuffer();
+
+	MappedBuffer& operator = (const MappedBuffer& other);
+	MappedBuffer& operator = (MappedBuffer&& other);
+
+	bool IsValid() const { return m_Mapping != NULL; }
+	void* GetData() const;
+	jlong GetSize() const;
+
+	// A new local ref to a bitter.jnibridge.MappedBuffer, which keeps the mapping alive until its close() is called.
+	// Its buffer() is a direct ByteBuffer over the mapping, read-only for kReadOnly.
+	jobject NewJavaObject() const;
+
+	bool Advise(Advice advice, jlong offset = 0, jlong length = -1) const;
+	// Writes modified pages back to the file (read-write mappings only)
+	bool Flush() const;
+
+	// Internal, shared by all copies and Java owners of one mapping
+	struct Mapping;
+
+private:
+	Mapping* m_Mapping;
+};
+
+}
@@ -0,0 +1,274 @@
+#include "Marshal.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace jni
+{
+
+static jni::Class s_MarshalBridgeClass("bitter/jnibridge/JNIBridge");
+
+// Buffer layout shared with JNIBridge.marshal/unmarshal, in native byte order:
+//   [jint size, Java to native only] [kind 'M' or 'L'] [jint count] then count keys and values, or count values
+// A value is its type tag followed by the raw primitive, or by a jint length and UTF-8 bytes for strings.
+static const char kMarshalMap = 'M';
+static const char kMarshalList = 'L';
+
+class MarshalReader
+{
+public:
+	MarshalReader(const char* data, size_t size) : m_Data(data), m_Size(size), m_Position(0) {}
+
+	template <typename T> bool Read(T& value)
+	{
+		if (m_Size - m_Position < sizeof(T))
+			return false;
+		memcpy(&value, m_Data + m_Position, sizeof(T));
+		m_Position += sizeof(T);
+		return true;
+	}
+
+	bool ReadString(std::string& value)
+	{
+		jint length;
+		if (!Read(length) || length < 0 || m_Size - m_Position < static_cast<size_t>(length))
+			return false;
+		value.assign(m_Data + m_Position, length);
+		m_Position += length;
+		return true;
+	}
+
+	bool ReadValue(MarshalValue& value)
+	{
+		char type;
+		if (!Read(type))
+			return false;
+		value.type = static_cast<MarshalValue::Type>(type);
+		value.integer = 0;
+		value.real = 0;
+		value.string.clear();
+		switch (type)
+		{
+			case MarshalValue::kNull:    return true;
+			case MarshalValue::kBoolean: { jboolean v; if (!Read(v)) return false; value.integer = v; return true; }
+			case MarshalValue::kByte:    { jbyte v;    if (!Read(v)) return false; value.integer = v; return true; }
+			case MarshalValue::kChar:    { jchar v;    if (!Read(v)) return false; value.integer = v; return true; }
+			case MarshalValue::kShort:   { jshort v;   if (!Read(v)) return false; value.integer = v; return true; }
+			case MarshalValue::kInt:     { jint v;     if (!Read(v)) return false; value.integer = v; return true; }
+			case MarshalValue::kLong:    return Read(value.integer);
+			case MarshalValue::kFloat:   { jfloat v;   if (!Read(v)) return false; value.real = v; return true; }
+			case MarshalValue::kDouble:  return Read(value.real);
+			case MarshalValue::kString:  return ReadString(value.string);
+		}
+		return false;
+	}
+
+private:
+	const char* m_Data;
+	size_t m_Size;
+	size_t m_Position;
+};
+
+class MarshalWriter
+{
+public:
+	template <typename T> void Write(const T& value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		m_Buffer.insert(m_Buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	void WriteString(const std::string& value)
+	{
+		Write(static_cast<char>(MarshalValue::kString));
+		Write(static_cast<jint>(value.size()));
+		m_Buffer.insert(m_Buffer.end(), value.begin(), value.end());
+	}
+
+	void WriteValue(const MarshalValue& value)
+	{
+		switch (value.type)
+		{
+			case MarshalValue::kBoolean: Write(static_cast<char>(value.type)); Write(static_cast<jboolean>(value.integer)); break;
+			case MarshalValue::kByte:    Write(static_cast<char>(value.type)); Write(static_cast<jbyte>(value.integer)); break;
+			case MarshalValue::kChar:    Write(static_cast<char>(value.type)); Write(static_cast<jchar>(value.integer)); break;
+			case MarshalValue::kShort:   Write(static_cast<char>(value.type)); Write(static_cast<jshort>(value.integer)); break;
+			case MarshalValue::kInt:     Write(static_cast<char>(value.type)); Write(static_cast<jint>(value.integer)); break;
+			case MarshalValue::kLong:    Write(static_cast<char>(value.type)); Write(value.integer); break;
+			case MarshalValue::kFloat:   Write(static_cast<char>(value.type)); Write(static_cast<jfloat>(value.real)); break;
+			case MarshalValue::kDouble:  Write(static_cast<char>(value.type)); Write(value.real); break;
+			case MarshalValue::kString:  WriteString(value.string); break;
+			default:                     Write(static_cast<char>(MarshalValue::kNull)); break;
+		}
+	}
+
+	void WriteHeader(char kind, size_t count)
+	{
+		Write(kind);
+		Write(static_cast<jint>(count));
+	}
+
+	jobject ToJava()
+	{
+		static jmethodID unmarshalMID = jni::GetStaticMethodID(s_MarshalBridgeClass, "unmarshal", "(Ljava/nio/ByteBuffer;)Ljava/lang/Object;");
+		jobject buffer = jni::NewDirectByteBuffer(&m_Buffer[0], static_cast<jlong>(m_Buffer.size()));
+		if (!buffer)
+			return NULL;
+		jobject result = jni::Op<jobject>::CallStaticMethod(s_MarshalBridgeClass, unmarshalMID, buffer);
+		jni::DeleteLocalRef(buffer);
+		return result;
+	}
+
+private:
+	std::vector<char> m_Buffer;
+};
+
+std::string MarshalValue::ToString() const
+{
+	char buffer[32];
+	switch (type)
+	{
+		case kNull:    return std::string();
+		case kBoolean: return integer ? "true" : "false";
+		case kFloat:   snprintf(buffer, sizeof(buffer), "%.9g", real); return buffer;
+		case kDouble:  snprintf(buffer, sizeof(buffer), "%.17g", real); return buffer;
+		case kString:  return string;
+		default:       snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(integer)); return buffer;
+	}
+}
+
+// The returned reader points into a per-thread Java buffer, it stays valid until the next marshal call on this thread
+static bool Marshal(jobject container, bool asStrings, char expectedKind, jint& count, MarshalReader& reader)
+{
+	static jmethodID marshalMID = jni::GetStaticMethodID(s_MarshalBridgeClass, "marshal", "(Ljava/lang/Object;Z)Ljava/nio/ByteBuffer;");
+	jobject buffer = jni::Op<jobject>::CallStaticMethod(s_MarshalBridgeClass, marshalMID, container, static_cast<jboolean>(asStrings));
+	if (!buffer)
+		return false;
+
+	const char* data = static_cast<const char*>(jni::GetDirectBufferAddress(buffer));
+	jni::DeleteLocalRef(buffer);
+	jint size;
+	if (!data)
+		return false;
+	memcpy(&size, data, sizeof(size));
+	if (size < static_cast<jint>(sizeof(size)))
+		return false;
+
+	char kind;
+	reader = MarshalReader(data + sizeof(size), size - sizeof(size));
+	return reader.Read(kind) && kind == expectedKind && reader.Read(count) && count >= 0;
+}
+
+bool ToNative(jobject map, MarshalMap& result)
+{
+	jint count;
+	MarshalReader reader(NULL, 0);
+	if (!Marshal(map, false, kMarshalMap, count, reader))
+		return false;
+
+	result.reserve(result.size() + count);
+	MarshalValue key;
+	for (jint i = 0; i < count; ++i)
+	{
+		if (!reader.ReadValue(key) || !reader.ReadValue(result[key.string]))
+			return false;
+	}
+	return true;
+}
+
+bool ToNative(jobject map, std::unordered_map<std::string, std::string>& result)
+{
+	jint count;
+	MarshalReader reader(NULL, 0);
+	if (!Marshal(map, true, kMarshalMap, count, reader))
+		return false;
+
+	result.reserve(result.size() + count);
+	MarshalValue key, value;
+	for (jint i = 0; i < count; ++i)
+	{
+		if (!reader.ReadValue(key) || !reader.ReadValue(value))
+			return false;
+		result[key.string].swap(value.string);
+	}
+	return true;
+}
+
+bool ToNative(jobject collection, MarshalList& result)
+{
+	jint count;
+	MarshalReader reader(NULL, 0);
+	if (!Marshal(collection, false, kMarshalList, count, reader))
+		return false;
+
+	size_t offset = result.size();
+	result.resize(offset + count);
+	for (jint i = 0; i < count; ++i)
+	{
+		if (!reader.ReadValue(result[offset + i]))
+			return false;
+	}
+	return true;
+}
+
+bool ToNative(jobject collection, std::vector<std::string>& result)
+{
+	jint count;
+	MarshalReader reader(NULL, 0);
+	if (!Marshal(collection, true, kMarshalList, count, reader))
+		return false;
+
+	result.reserve(result.size() + count);
+	MarshalValue value;
+	for (jint i = 0; i < count; ++i)
+	{
+		if (!reader.ReadValue(value))
+			return false;
+		result.push_back(std::string());
+		result.back().swap(value.string);
+	}
+	return true;
+}
+
+jobject ToJavaMap(const MarshalMap& map)
+{
+	MarshalWriter writer;
+	writer.WriteHeader(kMarshalMap, map.size());
+	for (MarshalMap::const_iterator it = map.begin(); it != map.end(); ++it)
+	{
+		writer.WriteString(it->first);
+		writer.WriteValue(it->second);
+	}
+	return writer.ToJava();
+}
+
+jobject ToJavaMap(const std::unordered_map<std::string, std::string>& map)
+{
+	MarshalWriter writer;
+	writer.WriteHeader(kMarshalMap, map.size());
+	for (std::unordered_map<std::string, std::string>::const_iterator it = map.begin(); it != map.end(); ++it)
+	{
+		writer.WriteString(it->first);
+		writer.WriteString(it->second);
+	}
+	return writer.ToJava();
+}
+
+jobject ToJavaList(const MarshalList& list)
+{
+	MarshalWriter writer;
+	writer.WriteHeader(kMarshalList, list.size());
+	for (MarshalList::const_iterator it = list.begin(); it != list.end(); ++it)
+		writer.WriteValue(*it);
+	return writer.ToJava();
+}
+
+jobject ToJavaList(const std::vector<std::string>& list)
+{
+	MarshalWriter writer;
+	writer.WriteHeader(kMarshalList, list.size());
+	for (std::vector<std::string>::const_iterator it = list.begin(); it != list.end(); ++it)
+		writer.WriteString(*it);
+	return writer.ToJava();
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "APIHelper.h"
+
+namespace jni
+{
+
+// A string or boxed primitive copied out of (or into) a Java container
+struct MarshalValue
+{
+	// Type tags are shared with JNIBridge.marshal/unmarshal
+	enum Type
+	{
+		kNull    = 'N',
+		kBoolean = 'Z',
+		kByte    = 'B',
+		kChar    = 'C',
+		kShort   = 'S',
+		kInt     = 'I',
+		kLong    = 'J',
+		kFloat   = 'F',
+		kDouble  = 'D',
+		kString  = 'T'
+	};
+
+	MarshalValue()                       : type(kNull), integer(0), real(0) {}
+	MarshalValue(jboolean value)         : type(kBoolean), integer(value), real(0) {}
+	MarshalValue(jbyte value)            : type(kByte), integer(value), real(0) {}
+	MarshalValue(jchar value)            : type(kChar), integer(value), real(0) {}
+	MarshalValue(jshort value)           : type(kShort), integer(value), real(0) {}
+	MarshalValue(jint value)             : type(kInt), integer(value), real(0) {}
+	MarshalValue(jlong value)            : type(kLong), integer(value), real(0) {}
+	MarshalValue(jfloat value)           : type(kFloat), integer(0), real(value) {}
+	MarshalValue(jdouble value)          : type(kDouble), integer(0), real(value) {}
+	MarshalValue(const char* value)      : type(value ? kString : kNull), integer(0), real(0), string(value ? value : "") {}
+	MarshalValue(const std::string& value) : type(kString), integer(0), real(0), string(value) {}
+
+	bool IsNull() const { return type == kNull; }
+	std::string ToString() const;
+
+	Type        type;
+	jlong       integer;
+	jdouble     real;
+	std::string string;
+};
+
+typedef std::unordered_map<std::string, MarshalValue> MarshalMap;
+typedef std::vector<MarshalValue> MarshalList;
+
+// Copies a java.util.Map, Properties (including defaults) or Collection in a single crossing.
+// Map keys are converted with String.valueOf, other values than strings and boxed primitives come through as their toString().
+bool    ToNative(jobject map, MarshalMap& result);
+bool    ToNative(jobject map, std::unordered_map<std::string, std::string>& result);
+bool    ToNative(jobject collection, MarshalList& result);
+bool    ToNative(jobject collection, std::vector<std::string>& result);
+
+// Builds a java.util.HashMap or ArrayList, returns a local ref
+jobject ToJavaMap(const MarshalMap& map);
+jobject ToJavaMap(const std::unordered_map<std::string, std::string>& map);
+jobject ToJavaList(const MarshalList& list);
+jobject ToJavaList(const std::vector<std::string>& list);
+
+}
@@ -0,0 +1,19 @@
+#include "Natives.h"
+#include <vector>
+
+namespace jni
+{
+
+bool RegisterNatives(jclass clazz, const NativeMethod* methods, jint nMethods)
+{
+	std::vector<JNINativeMethod> natives(nMethods);
+	for (jint i = 0; i < nMethods; ++i)
+	{
+		natives[i].name = const_cast<char*>(methods[i].name);
+		natives[i].signature = const_cast<char*>(methods[i].signature.c_str());
+		natives[i].fnPtr = methods[i].function;
+	}
+	return nMethods > 0 && jni::RegisterNatives(clazz, &natives[0], nMethods);
+}
+
+}
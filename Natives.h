@@ -0,0 +1,149 @@
+#pragma once
+
+#include <string>
+#include <type_traits>
+#include "APIHelper.h"
+
+namespace jni
+{
+
+// How a parameter or return type of a native crosses JNI: the raw type the VM passes, its signature and the conversions.
+// The default covers generated classes, which come in as their jobject and go out as a new local ref.
+template <typename T>
+struct NativeType
+{
+	typedef jobject JNIType;
+	static void AppendSignature(std::string& signature) { signature += 'L'; signature += T::__CLASS.GetName(); signature += ';'; }
+	static T FromJNI(jobject value) { return T(value); }
+	static jobject ToJNI(const T& value) { return jni::NewLocalRef(static_cast<jobject>(value)); }
+};
+
+template <typename T>
+struct NativeType< Array<T> >
+{
+	typedef jobject JNIType;
+	static void AppendSignature(std::string& signature) { signature += '['; NativeType<T>::AppendSignature(signature); }
+	static Array<T> FromJNI(jobject value) { return Array<T>(value); }
+	static jobject ToJNI(const Array<T>& value) { return jni::NewLocalRef(static_cast<jobject>(value)); }
+};
+
+#define DEF_NATIVE_TYPE(t, sig) \
+template <> \
+struct NativeType<t> \
+{ \
+	typedef t JNIType; \
+	static void AppendSignature(std::string& signature) { signature += sig; } \
+	static t FromJNI(t value) { return value; } \
+	static t ToJNI(t value) { return value; } \
+};
+
+DEF_NATIVE_TYPE(jboolean,      "Z")
+DEF_NATIVE_TYPE(jbyte,         "B")
+DEF_NATIVE_TYPE(jchar,         "C")
+DEF_NATIVE_TYPE(jshort,        "S")
+DEF_NATIVE_TYPE(jint,          "I")
+DEF_NATIVE_TYPE(jlong,         "J")
+DEF_NATIVE_TYPE(jfloat,        "F")
+DEF_NATIVE_TYPE(jdouble,       "D")
+DEF_NATIVE_TYPE(jobject,       "Ljava/lang/Object;")
+DEF_NATIVE_TYPE(jclass,        "Ljava/lang/Class;")
+DEF_NATIVE_TYPE(jstring,       "Ljava/lang/String;")
+DEF_NATIVE_TYPE(jthrowable,    "Ljava/lang/Throwable;")
+DEF_NATIVE_TYPE(jobjectArray,  "[Ljava/lang/Object;")
+DEF_NATIVE_TYPE(jbooleanArray, "[Z")
+DEF_NATIVE_TYPE(jbyteArray,    "[B")
+DEF_NATIVE_TYPE(jcharArray,    "[C")
+DEF_NATIVE_TYPE(jshortArray,   "[S")
+DEF_NATIVE_TYPE(jintArray,     "[I")
+DEF_NATIVE_TYPE(jlongArray,    "[J")
+DEF_NATIVE_TYPE(jfloatArray,   "[F")
+DEF_NATIVE_TYPE(jdoubleArray,  "[D")
+
+#undef DEF_NATIVE_TYPE
+
+template <>
+struct NativeType<void>
+{
+	static void AppendSignature(std::string& signature) { signature += 'V'; }
+};
+
+// Adapts R function(JNIEnv*, Self, Args...) to the raw JNI calling convention, Self being
+// the receiver (jobject or a generated class) or jclass for static natives.
+template <typename F, F function>
+struct NativeThunk;
+
+template <typename R, typename S, typename... A, R (*function)(JNIEnv*, S, A...)>
+struct NativeThunk<R (*)(JNIEnv*, S, A...), function>
+{
+	typedef NativeType<typename std::decay<R>::type> Return;
+	typedef NativeType<typename std::decay<S>::type> Self;
+
+	static typename Return::JNIType JNICALL Call(JNIEnv* env, typename Self::JNIType self, typename NativeType<typename std::decay<A>::type>::JNIType... args)
+	{
+		return Return::ToJNI(function(env, Self::FromJNI(self), NativeType<typename std::decay<A>::type>::FromJNI(args)...));
+	}
+
+	static std::string GetSignature()
+	{
+		std::string signature("(");
+		int expand[] = { 0, (NativeType<typename std::decay<A>::type>::AppendSignature(signature), 0)... };
+		(void)expand;
+		signature += ')';
+		Return::AppendSignature(signature);
+		return signature;
+	}
+};
+
+template <typename S, typename... A, void (*function)(JNIEnv*, S, A...)>
+struct NativeThunk<void (*)(JNIEnv*, S, A...), function>
+{
+	typedef NativeType<typename std::decay<S>::type> Self;
+
+	static void JNICALL Call(JNIEnv* env, typename Self::JNIType self, typename NativeType<typename std::decay<A>::type>::JNIType... args)
+	{
+		function(env, Self::FromJNI(self), NativeType<typename std::decay<A>::type>::FromJNI(args)...);
+	}
+
+	static std::string GetSignature()
+	{
+		std::string signature("(");
+		int expand[] = { 0, (NativeType<typename std::decay<A>::type>::AppendSignature(signature), 0)... };
+		(void)expand;
+		signature += ")V";
+		return signature;
+	}
+};
+
+struct NativeMethod
+{
+	template <typename F, F function>
+	static NativeMethod Create(const char* name)
+	{
+		NativeMethod method = { name, NativeThunk<F, function>::GetSignature(), reinterpret_cast<void*>(&NativeThunk<F, function>::Call) };
+		return method;
+	}
+
+	const char* name;
+	std::string signature;
+	void*       function;
+};
+
+// JNI_NATIVE_METHOD("nativeUpdate", Update) registers
+//   static void Update(JNIEnv* env, const ::com::example::View& view, jint width, const ::java::lang::String& title)
+// as "nativeUpdate(ILjava/lang/String;)V", the signature is taken from the C++ parameter types.
+// Raw jobject/jobjectArray parameters map to Object/Object[], use the generated types for anything more specific.
+#define JNI_NATIVE_METHOD(name, function) jni::NativeMethod::Create<decltype(&function), &function>(name)
+
+bool RegisterNatives(jclass clazz, const NativeMethod* methods, jint nMethods);
+
+// Binds all natives of a generated class in one call, typically from JNI_OnLoad, which saves
+// the lazy Java_* symbol lookup on first call and lets those symbols be stripped.
+//   jni::RegisterNatives< ::com::example::View >(JNI_NATIVE_METHOD("nativeUpdate", Update), JNI_NATIVE_METHOD("nativeDraw", Draw));
+template <typename T, typename... M>
+bool RegisterNatives(const M&... methods)
+{
+	const NativeMethod list[] = { methods... };
+	return RegisterNatives(T::__CLASS, list, static_cast<jint>(sizeof...(M)));
+}
+
+}
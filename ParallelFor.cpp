@@ -0,0 +1,147 @@
+#include "ParallelFor.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jni
+{
+
+// Fork-join pool, one run at a time. Workers pick chunks off a shared counter until the run is used up.
+class ParallelPool
+{
+public:
+	ParallelPool()
+	: m_Job(NULL)
+	, m_Generation(0)
+	, m_Busy(0)
+	, m_Stopping(false)
+	{
+		unsigned nThreads = std::max(1u, std::thread::hardware_concurrency());
+		m_Threads.reserve(nThreads);
+		for (unsigned i = 0; i < nThreads; ++i)
+			m_Threads.push_back(std::thread(&ParallelPool::WorkerLoop, this));
+	}
+
+	~ParallelPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+			m_Stopping = true;
+		}
+		m_Wakeup.notify_all();
+		for (std::thread& thread : m_Threads)
+			thread.join();
+	}
+
+	unsigned GetThreadCount() const { return static_cast<unsigned>(m_Threads.size()); }
+
+	bool IsWorkerThread() const
+	{
+		std::thread::id current = std::this_thread::get_id();
+		for (const std::thread& thread : m_Threads)
+			if (thread.get_id() == current)
+				return true;
+		return false;
+	}
+
+	void Run(jsize count, jsize grain, const std::function<void(jsize, jsize)>& kernel)
+	{
+		std::lock_guard<std::mutex> run(m_RunLock);
+		Job job = { &kernel, count, grain, {0}, {0} };
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+			m_Job = &job;
+			++m_Generation;
+		}
+		m_Wakeup.notify_all();
+
+		// Workers which haven't woken up yet find no job and go back to sleep
+		std::unique_lock<std::mutex> lock(m_Lock);
+		while (job.done < count || m_Busy)
+			m_Joined.wait(lock);
+		m_Job = NULL;
+	}
+
+private:
+	struct Job
+	{
+		const std::function<void(jsize, jsize)>* kernel;
+		jsize count;
+		jsize grain;
+		// Wide enough for every worker to overshoot once past the largest array
+		std::atomic<jlong> next;
+		std::atomic<jlong> done;
+	};
+
+	static void RunChunks(Job& job)
+	{
+		for (jlong begin = job.next.fetch_add(job.grain); begin < job.count; begin = job.next.fetch_add(job.grain))
+		{
+			jsize end = static_cast<jsize>(std::min<jlong>(job.count, begin + job.grain));
+			(*job.kernel)(static_cast<jsize>(begin), end);
+			job.done.fetch_add(end - begin);
+		}
+	}
+
+	void WorkerLoop()
+	{
+		unsigned seen = 0;
+		std::unique_lock<std::mutex> lock(m_Lock);
+		for (;;)
+		{
+			while (m_Generation == seen && !m_Stopping)
+				m_Wakeup.wait(lock);
+			if (m_Stopping)
+				break;
+			seen = m_Generation;
+			Job* job = m_Job;
+			if (!job)
+				continue;
+
+			++m_Busy;
+			lock.unlock();
+			RunChunks(*job);
+			lock.lock();
+			if (--m_Busy == 0)
+				m_Joined.notify_all();
+		}
+	}
+
+	std::vector<std::thread> m_Threads;
+	std::mutex m_RunLock;
+	std::mutex m_Lock;
+	std::condition_variable m_Wakeup;
+	std::condition_variable m_Joined;
+	Job* m_Job;
+	unsigned m_Generation;
+	unsigned m_Busy;
+	bool m_Stopping;
+};
+
+static ParallelPool& GetParallelPool()
+{
+	static ParallelPool pool;
+	return pool;
+}
+
+void ParallelRun(jsize count, jsize grain, const std::function<void(jsize, jsize)>& kernel)
+{
+	if (count <= 0)
+		return;
+	ParallelPool& pool = GetParallelPool();
+	// The run this kernel belongs to holds the pool until all of its chunks are done
+	if (pool.IsWorkerThread())
+	{
+		kernel(0, count);
+		return;
+	}
+	// A few chunks per thread evens out uneven kernels without making chunks too small to be worth it
+	if (grain <= 0)
+		grain = std::max<jsize>(1024, (count + pool.GetThreadCount() * 4 - 1) / (pool.GetThreadCount() * 4));
+	pool.Run(count, grain, kernel);
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include "APIHelper.h"
+
+namespace jni
+{
+
+enum PinMode
+{
+	kPinCritical,	// GetPrimitiveArrayCritical, usually no copy but the GC may be held off until the run is done
+	kPinElements	// Get<Type>ArrayElements, may copy but never blocks the GC
+};
+
+// Runs kernel(begin, end) over [0, count) in chunks of grain elements (0 picks one) on a shared pool of native
+// threads and returns once every chunk is done. The pool threads are never attached to the VM and the calling
+// thread only waits, it makes no JNI calls in between. Runs are serialized, one started from inside a kernel
+// runs inline on that pool thread instead of waiting for the run it is part of.
+void ParallelRun(jsize count, jsize grain, const std::function<void(jsize, jsize)>& kernel);
+
+// Pins array once, runs kernel(T* elements, jsize begin, jsize end) over its chunks in parallel and releases it,
+// writing the elements back unless writeBack is false. Kernels must not call into JNI (which includes ParallelFor),
+// with kPinCritical the calling thread holds the critical pin for the whole run.
+// Returns false when the array is null, an exception is pending or the array can't be pinned.
+template <typename T, typename F>
+bool ParallelFor(const Array<T>& array, F kernel, PinMode pin = kPinCritical, bool writeBack = true, jsize grain = 0)
+{
+	if (!array)
+		return false;
+	jsize length = array.Length();
+	if (pin == kPinElements)
+	{
+		T* elements = array.Lock();
+		if (!elements)
+			return false;
+		if (length > 0)
+			ParallelRun(length, grain, [&](jsize begin, jsize end) { kernel(elements, begin, end); });
+		array.Release(elements, writeBack);
+		return true;
+	}
+
+	// The checks of LockCritical/ReleaseCritical would be JNI calls inside the critical region,
+	// a pending exception is looked for once up front and the pin goes straight through the env
+	JNIEnv* env = AttachCurrentThread();
+	if (!env || CheckForExceptionError(env))
+		return false;
+	T* elements = static_cast<T*>(env->GetPrimitiveArrayCritical(array, NULL));
+	if (!elements)
+	{
+		// Nothing is pinned, so reporting the OutOfMemoryError is safe again
+		CheckForExceptionError(env);
+		return false;
+	}
+	if (length > 0)
+		ParallelRun(length, grain, [&](jsize begin, jsize end) { kernel(elements, begin, end); });
+	env->ReleasePrimitiveArrayCritical(array, elements, writeBack ? 0 : JNI_ABORT);
+	return true;
+}
+
+}
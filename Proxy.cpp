@@ -1,4 +1,7 @@
 #include "Proxy.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 namespace jni
 {
@@ -8,6 +11,125 @@ jni::Class s_JNIBridgeClass("bitter/jnibridge/JNIBridge");
 std::atomic<unsigned> ProxyObject::proxyCount;
 #endif
 
+#if defined(ENABLE_PROXY_STATISTICS)
+std::atomic<ProxyStatistics*> ProxyStatistics::s_First;
+
+ProxyStatistics::ProxyStatistics(const char** interfaceNames, unsigned nInterfaces)
+{
+	for (unsigned i = 0; i < nInterfaces; ++i)
+	{
+		if (i > 0)
+			m_Name += ", ";
+		m_Name += interfaceNames[i];
+	}
+	for (unsigned i = 0; i < kMaxMethods; ++i)
+	{
+		m_Methods[i].methodID.store(NULL, std::memory_order_relaxed);
+		m_Methods[i].clazz.store(NULL, std::memory_order_relaxed);
+	}
+	Reset();
+
+	m_Next = s_First.load(std::memory_order_relaxed);
+	while (!s_First.compare_exchange_weak(m_Next, this, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+void ProxyStatistics::Reset()
+{
+	Counters* counters[kMaxMethods + 1];
+	counters[0] = &m_Totals;
+	for (unsigned i = 0; i < kMaxMethods; ++i)
+		counters[i + 1] = &m_Methods[i];
+	for (Counters* c : counters)
+	{
+		c->invocations.store(0, std::memory_order_relaxed);
+		c->unhandled.store(0, std::memory_order_relaxed);
+		c->totalNanos.store(0, std::memory_order_relaxed);
+		c->maxNanos.store(0, std::memory_order_relaxed);
+	}
+	m_CallsAfterDisable.store(0, std::memory_order_relaxed);
+}
+
+void ProxyStatistics::Add(Counters& counters, jlong nanos, bool handled)
+{
+	counters.invocations.fetch_add(1, std::memory_order_relaxed);
+	if (!handled)
+		counters.unhandled.fetch_add(1, std::memory_order_relaxed);
+	counters.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+	jlong maxNanos = counters.maxNanos.load(std::memory_order_relaxed);
+	while (nanos > maxNanos && !counters.maxNanos.compare_exchange_weak(maxNanos, nanos, std::memory_order_relaxed)) {}
+}
+
+// Open addressing on the jmethodID, slots are claimed once and never freed
+ProxyStatistics::MethodCounters* ProxyStatistics::Find(jclass clazz, jmethodID methodID)
+{
+	unsigned hash = static_cast<unsigned>(reinterpret_cast<uintptr_t>(methodID) >> 3);
+	for (unsigned i = 0; i < kMaxMethods; ++i)
+	{
+		MethodCounters& method = m_Methods[(hash + i) % kMaxMethods];
+		jmethodID current = method.methodID.load(std::memory_order_acquire);
+		if (current == methodID)
+			return &method;
+		if (current != NULL)
+			continue;
+		if (method.methodID.compare_exchange_strong(current, methodID, std::memory_order_acq_rel))
+		{
+			method.clazz.store(static_cast<jclass>(jni::NewGlobalRef(clazz)), std::memory_order_release);
+			return &method;
+		}
+		if (current == methodID)
+			return &method;
+	}
+	return NULL;
+}
+
+void ProxyStatistics::Record(jclass clazz, jmethodID methodID, jlong nanos, bool handled)
+{
+	Add(m_Totals, nanos, handled);
+	if (MethodCounters* method = Find(clazz, methodID))
+		Add(*method, nanos, handled);
+}
+
+void ProxyStatistics::Dump()
+{
+	for (ProxyStatistics* statistics = First(); statistics; statistics = statistics->Next())
+	{
+		const Counters& totals = statistics->GetTotals();
+		printf("%s: %lld calls, %lld unhandled, %lld after disable, %.3f ms total, %.3f ms max\n",
+			statistics->GetName(),
+			(long long) totals.invocations.load(std::memory_order_relaxed),
+			(long long) totals.unhandled.load(std::memory_order_relaxed),
+			(long long) statistics->GetCallsAfterDisable(),
+			totals.totalNanos.load(std::memory_order_relaxed) / 1e6,
+			totals.maxNanos.load(std::memory_order_relaxed) / 1e6);
+
+		for (unsigned i = 0; i < kMaxMethods; ++i)
+		{
+			const MethodCounters& method = statistics->GetMethod(i);
+			jmethodID methodID = method.methodID.load(std::memory_order_acquire);
+			jclass clazz = method.clazz.load(std::memory_order_acquire);
+			if (!methodID || !clazz)
+				continue;
+
+			jni::LocalScope frame;
+			java::lang::reflect::Method reflected(jni::ToReflectedMethod(clazz, methodID, false));
+			printf("\t%s: %lld calls, %lld unhandled, %.3f ms total, %.3f ms max\n",
+				reflected ? reflected.ToString().c_str() : "<unknown method>",
+				(long long) method.invocations.load(std::memory_order_relaxed),
+				(long long) method.unhandled.load(std::memory_order_relaxed),
+				method.totalNanos.load(std::memory_order_relaxed) / 1e6,
+				method.maxNanos.load(std::memory_order_relaxed) / 1e6);
+		}
+	}
+}
+#endif
+
+// Lets Java fall back to default methods without a NoSuchMethodError being thrown and caught on every call
+static jobject NotHandled()
+{
+	static Ref<GlobalRefAllocator, jobject> notHandled(jni::Op<jobject>::GetStaticField(s_JNIBridgeClass, jni::GetStaticFieldID(s_JNIBridgeClass, "NOT_HANDLED", "Ljava/lang/Object;")));
+	return jni::NewLocalRef(notHandled);
+}
+
 JNIEXPORT jobject JNICALL Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invoke(JNIEnv* env, jobject thiz, jlong ptr, jclass clazz, jobject method, jobjectArray args)
 {
 	jmethodID methodID = env->FromReflectedMethod(method);
@@ -25,20 +147,72 @@ JNIEXPORT jobject JNICALL Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_in
 	return proxy->__Invoke(clazz, methodID, args);
 }
 
+JNIEXPORT jobject JNICALL Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invokeUnboxed(JNIEnv* env, jobject thiz, jlong ptr, jclass clazz, jobject method, jobjectArray args, jlongArray primitives)
+{
+	static const jsize kMaxStackPrimitives = 16;
+	jlong stackPrimitives[kMaxStackPrimitives];
+
+	jmethodID methodID = env->FromReflectedMethod(method);
+	jsize nPrimitives = args ? env->GetArrayLength(args) : 0;
+	jlong* values = nPrimitives <= kMaxStackPrimitives ? stackPrimitives : static_cast<jlong*>(malloc(nPrimitives * sizeof(jlong)));
+	if (!values)
+	{
+		jclass oomClass = env->FindClass("java/lang/OutOfMemoryError");
+		if (oomClass)
+			env->ThrowNew(oomClass, "Unable to allocate proxy call arguments");
+		return NULL;
+	}
+	if (nPrimitives)
+		env->GetLongArrayRegion(primitives, 0, nPrimitives, values);
+
+	jlong primitiveResult = 0;
+	ProxyObject* proxy = (ProxyObject*)ptr;
+	jobject result = proxy->__InvokeUnboxed(clazz, methodID, args, values, &primitiveResult);
+	if (!env->ExceptionCheck())
+		env->SetLongArrayRegion(primitives, 0, 1, &primitiveResult);
+
+	if (values != stackPrimitives)
+		free(values);
+	return result;
+}
+
+JNIEXPORT void JNICALL Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invokeAsync(JNIEnv* env, jobject thiz, jlong ptr, jclass clazz, jobject method, jobjectArray args)
+{
+	jmethodID methodID = env->FromReflectedMethod(method);
+	ProxyObject* proxy = (ProxyObject*)ptr;
+	proxy->__InvokeAsync(clazz, methodID, args);
+}
+
+JNIEXPORT void JNICALL Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invokeDisabled(JNIEnv* env, jobject thiz, jlong statistics)
+{
+#if defined(ENABLE_PROXY_STATISTICS)
+	((ProxyStatistics*)statistics)->RecordCallAfterDisable();
+#endif
+}
+
 bool ProxyInvoker::__Register()
 {
 	jni::LocalScope frame;
 	jni::Class nativeProxyClass("bitter/jnibridge/JNIBridge");
 	char invokeMethodName[] = "invoke";
 	char invokeMethodSignature[] = "(JLjava/lang/Class;Ljava/lang/reflect/Method;[Ljava/lang/Object;)Ljava/lang/Object;";
+	char invokeUnboxedMethodName[] = "invokeUnboxed";
+	char invokeUnboxedMethodSignature[] = "(JLjava/lang/Class;Ljava/lang/reflect/Method;[Ljava/lang/Object;[J)Ljava/lang/Object;";
+	char invokeAsyncMethodName[] = "invokeAsync";
+	char invokeAsyncMethodSignature[] = "(JLjava/lang/Class;Ljava/lang/reflect/Method;[Ljava/lang/Object;)V";
+	char invokeDisabledMethodName[] = "invokeDisabled";
+	char invokeDisabledMethodSignature[] = "(J)V";
 	char deleteMethodName[] = "delete";
 	char deleteMethodSignature[] = "(J)V";
 
 	JNINativeMethod nativeProxyFunction[] = {
 		{invokeMethodName, invokeMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invoke},
+		{invokeUnboxedMethodName, invokeUnboxedMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invokeUnboxed},
+		{invokeAsyncMethodName, invokeAsyncMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invokeAsync},
+		{invokeDisabledMethodName, invokeDisabledMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invokeDisabled},
 	};
 
-	if (nativeProxyClass) jni::GetEnv()->RegisterNatives(nativeProxyClass, nativeProxyFunction, 1);
+	if (nativeProxyClass) jni::GetEnv()->RegisterNatives(nativeProxyClass, nativeProxyFunction, sizeof(nativeProxyFunction) / sizeof(nativeProxyFunction[0]));
 	return !jni::CheckError();
 }
 
@@ -61,10 +235,16 @@ jobject ProxyObject::__Invoke(jclass clazz, jmethodID mid, jobjectArray args)
 {
 	jobject result;
 	if (!__InvokeInternal(clazz, mid, args, &result))
-	{
-		java::lang::reflect::Method method(jni::ToReflectedMethod(clazz, mid, false));
-		jni::ThrowNew<java::lang::NoSuchMethodError>(method.ToString().c_str());
-	}
+		return NotHandled();
+
+	return result;
+}
+
+jobject ProxyObject::__InvokeUnboxed(jclass clazz, jmethodID mid, jobjectArray args, const jlong* primitives, jlong* primitiveResult)
+{
+	jobject result = NULL;
+	if (!__InvokeUnboxedInternal(clazz, mid, args, primitives, &result, primitiveResult))
+		return NotHandled();
 
 	return result;
 }
@@ -90,12 +270,35 @@ bool ProxyObject::__TryInvoke(jclass clazz, jmethodID methodID, jobjectArray arg
 	return false;
 }
 
+bool ProxyObject::__TryInvokeUnboxed(jclass clazz, jmethodID methodID, jobjectArray args, const jlong* primitives, bool* success, jobject* result, jlong* primitiveResult)
+{
+	if (*success)
+		return false;
+
+	if (!jni::IsSameObject(clazz, java::lang::Object::__CLASS))
+		return false;
+
+	static jmethodID methodIDs[] = {
+		jni::GetMethodID(java::lang::Object::__CLASS, "hashCode", "()I"),
+		jni::GetMethodID(java::lang::Object::__CLASS, "equals", "(Ljava/lang/Object;)Z")
+	};
+	if (methodIDs[0] == methodID) { *primitiveResult = jni::ToRawBits(HashCode()); *success = true; return true; }
+	if (methodIDs[1] == methodID) { *primitiveResult = jni::ToRawBits(Equals(::java::lang::Object(jni::GetObjectArrayElement(args, 0)))); *success = true; return true; }
+
+	// toString() has no primitives and always arrives through __TryInvoke
+	return false;
+}
+
 jobject ProxyObject::NewInstance(void* nativePtr, const jobject* interfaces, jsize interfaces_len)
 {
 	Array<jobject> interfaceArray(java::lang::Class::__CLASS, interfaces_len, interfaces);
+	return NewInstance(nativePtr, static_cast<jobjectArray>(interfaceArray));
+}
 
-	static jmethodID newProxyMID = jni::GetStaticMethodID(s_JNIBridgeClass, "newInterfaceProxy", "(J[Ljava/lang/Class;)Ljava/lang/Object;");
-	return  jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, newProxyMID, (jlong) nativePtr, static_cast<jobjectArray>(interfaceArray));
+jobject ProxyObject::NewInstance(void* nativePtr, jobjectArray interfaces, ProxyStatistics* statistics, bool async)
+{
+	static jmethodID newProxyMID = jni::GetStaticMethodID(s_JNIBridgeClass, "newInterfaceProxy", "(JJZ[Ljava/lang/Class;)Ljava/lang/Object;");
+	return  jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, newProxyMID, (jlong) nativePtr, (jlong) statistics, (jboolean) async, interfaces);
 }
 
 void ProxyObject::DisableInstance(jobject proxy)
@@ -104,4 +307,10 @@ void ProxyObject::DisableInstance(jobject proxy)
 	jni::Op<jvoid>::CallStaticMethod(s_JNIBridgeClass, disableProxyMID, proxy);
 }
 
+void ProxyObject::RecycleInstance(jobject proxy)
+{
+	static jmethodID recycleProxyMID = jni::GetStaticMethodID(s_JNIBridgeClass, "recycleInterfaceProxy", "(Ljava/lang/Object;)V");
+	jni::Op<jvoid>::CallStaticMethod(s_JNIBridgeClass, recycleProxyMID, proxy);
+}
+
 }
\ No newline at end of file
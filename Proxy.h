@@ -1,10 +1,92 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <type_traits>
 #include "API.h"
 namespace jni
 {
 
+class ProxyStatistics;
+
+#if defined(ENABLE_PROXY_STATISTICS)
+// Invocation counters of one proxy type, broken down per interface method, compiled in with ENABLE_PROXY_STATISTICS.
+// Updated with relaxed atomics only, but every invocation still pays two clock reads and a method lookup.
+// StubProxy calls go straight from the NativeStub_* natives to the C++ methods and aren't counted.
+class ProxyStatistics
+{
+public:
+	struct Counters
+	{
+		std::atomic<jlong> invocations;
+		std::atomic<jlong> unhandled;
+		std::atomic<jlong> totalNanos;
+		std::atomic<jlong> maxNanos;
+	};
+
+	struct MethodCounters : Counters
+	{
+		std::atomic<jmethodID> methodID;
+		std::atomic<jclass> clazz;
+	};
+
+	// Methods beyond this are only accounted for in GetTotals()
+	static const unsigned kMaxMethods = 64;
+
+	ProxyStatistics(const char** interfaceNames, unsigned nInterfaces);
+
+	const char* GetName() const { return m_Name.c_str(); }
+	const Counters& GetTotals() const { return m_Totals; }
+	const MethodCounters& GetMethod(unsigned index) const { return m_Methods[index]; }
+	jlong GetCallsAfterDisable() const { return m_CallsAfterDisable.load(std::memory_order_relaxed); }
+
+	void Record(jclass clazz, jmethodID methodID, jlong nanos, bool handled);
+	void RecordCallAfterDisable() { m_CallsAfterDisable.fetch_add(1, std::memory_order_relaxed); }
+	void Reset();
+
+	// All proxy types that have been instantiated so far, most recent first
+	static ProxyStatistics* First() { return s_First.load(std::memory_order_acquire); }
+	ProxyStatistics* Next() const { return m_Next; }
+	static void Dump();
+
+	class Scope
+	{
+	public:
+		Scope(ProxyStatistics& statistics, jclass clazz, jmethodID methodID, const bool& handled)
+		: m_Statistics(statistics), m_Class(clazz), m_MethodID(methodID), m_Handled(handled), m_Start(std::chrono::steady_clock::now()) {}
+		~Scope()
+		{
+			jlong nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+			m_Statistics.Record(m_Class, m_MethodID, nanos, m_Handled);
+		}
+
+	private:
+		ProxyStatistics& m_Statistics;
+		jclass m_Class;
+		jmethodID m_MethodID;
+		const bool& m_Handled;
+		std::chrono::steady_clock::time_point m_Start;
+	};
+
+private:
+	ProxyStatistics(const ProxyStatistics&);
+	ProxyStatistics& operator = (const ProxyStatistics&);
+
+	static void Add(Counters& counters, jlong nanos, bool handled);
+	MethodCounters* Find(jclass clazz, jmethodID methodID);
+
+	std::string m_Name;
+	Counters m_Totals;
+	MethodCounters m_Methods[kMaxMethods];
+	std::atomic<jlong> m_CallsAfterDisable;
+	ProxyStatistics* m_Next;
+
+	static std::atomic<ProxyStatistics*> s_First;
+};
+#endif
+
 class ProxyObject : public virtual ProxyInvoker
 {
 // Dispatch invoke calls
@@ -19,6 +101,9 @@ public:
 	}
 
 	virtual jobject __Invoke(jclass clazz, jmethodID mid, jobjectArray args);
+	virtual jobject __InvokeUnboxed(jclass clazz, jmethodID mid, jobjectArray args, const jlong* primitives, jlong* primitiveResult);
+	// Void methods of proxies created with __IsAsync() come in here, see AsyncProxy.h
+	virtual jobject __InvokeAsync(jclass clazz, jmethodID mid, jobjectArray args) { return __Invoke(clazz, mid, args); }
 	virtual void DisableProxy() = 0;
 
 // These functions are special and always forwarded
@@ -26,16 +111,21 @@ protected:
 	virtual ::jint HashCode() const;
 	virtual ::jboolean Equals(const ::jobject arg0) const;
 	virtual java::lang::String ToString() const;
+	virtual bool __IsAsync() const { return false; }
 
 	bool __TryInvoke(jclass clazz, jmethodID methodID, jobjectArray args, bool* success, jobject* result);
 	virtual bool __InvokeInternal(jclass clazz, jmethodID mid, jobjectArray args, jobject* result) = 0;
+	bool __TryInvokeUnboxed(jclass clazz, jmethodID methodID, jobjectArray args, const jlong* primitives, bool* success, jobject* result, jlong* primitiveResult);
+	virtual bool __InvokeUnboxedInternal(jclass clazz, jmethodID mid, jobjectArray args, const jlong* primitives, jobject* result, jlong* primitiveResult) = 0;
 
 // Factory stuff
 protected:
 	static jobject NewInstance(void* nativePtr, const jobject interfacce);
 	static jobject NewInstance(void* nativePtr, const jobject interfacce1, const jobject interfacce2);
 	static jobject NewInstance(void* nativePtr, const jobject* interfaces, jsize interfaces_len);
+	static jobject NewInstance(void* nativePtr, jobjectArray interfaces, ProxyStatistics* statistics = NULL, bool async = false);
 	static void DisableInstance(jobject proxy);
+	static void RecycleInstance(jobject proxy);
 
 #if !defined(DISABLE_PROXY_COUNTING)
 	static std::atomic<unsigned> proxyCount;
@@ -43,16 +133,39 @@ protected:
 };
 
 
+// The Java invocation handlers of a PooledProxy are handed back to a per interface set pool instead of being dropped.
+// Each owner still gets a new Java proxy object, stale references to a previous owner's proxy end up on the disabled path.
+class PooledRefAllocator : public GlobalRefAllocator {};
+
 template <class RefAllocator, class ...TX>
 class ProxyGenerator : public ProxyObject, public TX::__Proxy...
 {
 public:
+#if defined(ENABLE_PROXY_STATISTICS)
+	static ProxyStatistics& Statistics()
+	{
+		static const char* interfaceNames[] = { TX::__CLASS.GetName()... };
+		static ProxyStatistics statistics(interfaceNames, sizeof...(TX));
+		return statistics;
+	}
+#endif
+
+	// The Java call happens outside m_InstanceLock, a Java thread in the middle of invoke holds the proxy's
+	// invocation lock, which disabling waits for, and its callback may ask for __ProxyObject in the meantime
 	void DisableProxy() override
 	{
-		auto proxyObject = __ProxyObject();
+		jobject proxyObject;
+		{
+			std::lock_guard<std::mutex> lock(m_InstanceLock);
+			m_Disabled.store(true, std::memory_order_release);
+			proxyObject = m_ProxyInstance.exchange(NULL, std::memory_order_relaxed);
+		}
 		if (proxyObject)
 		{
-			DisableInstance(proxyObject);
+			if (std::is_same<RefAllocator, PooledRefAllocator>::value)
+				RecycleInstance(proxyObject);
+			else
+				DisableInstance(proxyObject);
 			m_ProxyObject.Release();
 #if !defined(DISABLE_PROXY_COUNTING)
 			proxyCount.fetch_sub(1, std::memory_order_relaxed);
@@ -61,39 +174,101 @@ public:
 	}
 
 protected:
-	ProxyGenerator() : m_ProxyObject(CreateInstance())
-	{
-#if !defined(DISABLE_PROXY_COUNTING)
-		proxyCount.fetch_add(1, std::memory_order_relaxed);
-#endif
-	}
+	ProxyGenerator() : m_ProxyObject(NULL), m_ProxyInstance(NULL), m_Disabled(false) {}
 
 	virtual ~ProxyGenerator()
 	{
 		DisableProxy();
 	}
 
-	::jobject __ProxyObject() const override { return m_ProxyObject; }
+	// The Java side is only created once the proxy is handed to Java for the first time
+	::jobject __ProxyObject() const override
+	{
+		if (m_Disabled.load(std::memory_order_acquire))
+			return NULL;
+		jobject proxyObject = m_ProxyInstance.load(std::memory_order_acquire);
+		return proxyObject ? proxyObject : const_cast<ProxyGenerator*>(this)->CreateProxyObject();
+	}
+
+	virtual jobject CreateInstance()
+	{
+		static jobject interfaceClasses[] = { TX::__CLASS... };
+		static Array<jobject> interfaces(java::lang::Class::__CLASS, sizeof...(TX), interfaceClasses);
+#if !defined(ENABLE_PROXY_STATISTICS)
+		ProxyStatistics* statistics = NULL;
+#else
+		ProxyStatistics* statistics = &Statistics();
+#endif
+		return NewInstance(static_cast<ProxyObject*>(this), interfaces, statistics, this->__IsAsync());
+	}
 
 private:
-	inline jobject CreateInstance()
+	jobject CreateProxyObject()
 	{
-		jobject interfaces[] = { TX::__CLASS... };
-		return NewInstance(this, interfaces, sizeof...(TX));
+		std::lock_guard<std::mutex> lock(m_InstanceLock);
+		jobject proxyObject = m_ProxyInstance.load(std::memory_order_relaxed);
+		if (proxyObject || m_Disabled.load(std::memory_order_relaxed))
+			return proxyObject;
+
+		m_ProxyObject = Ref<RefAllocator, jobject>(CreateInstance());
+		proxyObject = m_ProxyObject;
+		if (proxyObject)
+		{
+			m_ProxyInstance.store(proxyObject, std::memory_order_release);
+#if !defined(DISABLE_PROXY_COUNTING)
+			proxyCount.fetch_add(1, std::memory_order_relaxed);
+#endif
+		}
+		return proxyObject;
 	}
 
 	template<typename... Args> inline void DummyInvoke(Args&&...) {}
 	bool __InvokeInternal(jclass clazz, jmethodID mid, jobjectArray args, jobject* result) override
 	{
 		bool success = false;
+#if defined(ENABLE_PROXY_STATISTICS)
+		ProxyStatistics::Scope scope(Statistics(), clazz, mid, success);
+#endif
 		DummyInvoke(ProxyObject::__TryInvoke(clazz, mid, args, &success, result), TX::__Proxy::__TryInvoke(clazz, mid, args, &success, result)...);
 		return success;
 	}
+	bool __InvokeUnboxedInternal(jclass clazz, jmethodID mid, jobjectArray args, const jlong* primitives, jobject* result, jlong* primitiveResult) override
+	{
+		bool success = false;
+#if defined(ENABLE_PROXY_STATISTICS)
+		ProxyStatistics::Scope scope(Statistics(), clazz, mid, success);
+#endif
+		DummyInvoke(ProxyObject::__TryInvokeUnboxed(clazz, mid, args, primitives, &success, result, primitiveResult), TX::__Proxy::__TryInvokeUnboxed(clazz, mid, args, primitives, &success, result, primitiveResult)...);
+		return success;
+	}
 
 	Ref<RefAllocator, jobject> m_ProxyObject;
+	mutable std::atomic<jobject> m_ProxyInstance;
+	std::mutex m_InstanceLock;
+	std::atomic<bool> m_Disabled;
+};
+
+template <class ...TX> class Proxy       : public ProxyGenerator<GlobalRefAllocator, TX...> {};
+template <class ...TX> class WeakProxy   : public ProxyGenerator<WeakGlobalRefAllocator, TX...> {};
+template <class ...TX> class PooledProxy : public ProxyGenerator<PooledRefAllocator, TX...> {};
+
+// Backed by the NativeStub_* class APIGenerator emits for interfaces passed with --stubs.
+// Java calls the stub's registered natives directly instead of going through reflection and boxing.
+template <class RefAllocator, class TX>
+class StubProxyGenerator : public ProxyGenerator<RefAllocator, TX>
+{
+protected:
+	jobject CreateInstance() override
+	{
+		static bool registered = TX::__Proxy::__RegisterStub();
+		static jmethodID constructorID = jni::GetMethodID(TX::__Proxy::__STUB_CLASS, "<init>", "(J)V");
+		if (!registered)
+			return NULL;
+		return jni::NewObject(TX::__Proxy::__STUB_CLASS, constructorID, (jlong) static_cast<typename TX::__Proxy*>(this));
+	}
 };
 
-template <class ...TX> class Proxy     : public ProxyGenerator<GlobalRefAllocator, TX...> {};
-template <class ...TX> class WeakProxy : public ProxyGenerator<WeakGlobalRefAllocator, TX...> {};
+template <class TX> class StubProxy     : public StubProxyGenerator<GlobalRefAllocator, TX> {};
+template <class TX> class WeakStubProxy : public StubProxyGenerator<WeakGlobalRefAllocator, TX> {};
 
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "RingBuffer.h"
+#include "APIHelper.h"
+#include <string.h>
+
+namespace jni
+{
+
+static jni::Class s_RingBufferClass("bitter/jnibridge/RingBuffer");
+
+static const jint kRecordHeader = sizeof(jint);
+static const jint kWrapMarker = -1;
+
+static jlong AlignRecord(jlong size)
+{
+	return (kRecordHeader + size + 7) & ~static_cast<jlong>(7);
+}
+
+RingBuffer::RingBuffer(jint capacity)
+: m_Object(NULL)
+, m_Data(NULL)
+, m_Capacity(16)
+, m_Head(0)
+, m_Published(0)
+, m_Tail(0)
+{
+	while (m_Capacity < capacity && m_Capacity < (1 << 30))
+		m_Capacity <<= 1;
+
+	jni::LocalScope frame;
+	static jmethodID createMID = jni::GetStaticMethodID(s_RingBufferClass, "create", "(I)Lbitter/jnibridge/RingBuffer;");
+	static jmethodID bufferMID = jni::GetMethodID(s_RingBufferClass, "buffer", "()Ljava/nio/ByteBuffer;");
+	jobject object = jni::Op<jobject>::CallStaticMethod(s_RingBufferClass, createMID, m_Capacity);
+	jobject buffer = object ? jni::Op<jobject>::CallMethod(object, bufferMID) : NULL;
+	m_Data = buffer ? static_cast<char*>(jni::GetDirectBufferAddress(buffer)) : NULL;
+	if (m_Data)
+		m_Object = jni::NewGlobalRef(object);
+}
+
+RingBuffer::~RingBuffer()
+{
+	if (!m_Object)
+		return;
+	static jmethodID closeMID = jni::GetMethodID(s_RingBufferClass, "close", "()V");
+	Publish();
+	jni::Op<jvoid>::CallNonVirtualMethod(m_Object, s_RingBufferClass, closeMID);
+	jni::DeleteGlobalRef(m_Object);
+}
+
+// Only asks the consumer how far it got when the space consumed as of the last ask is used up
+bool RingBuffer::Reserve(jlong size)
+{
+	if (m_Head + size - m_Tail <= m_Capacity)
+		return true;
+
+	static jmethodID consumedMID = jni::GetMethodID(s_RingBufferClass, "consumed", "()J");
+	// Unpublished records can't be consumed, so they have to go out first
+	Publish();
+	m_Tail = jni::Op<jlong>::CallMethod(m_Object, consumedMID);
+	return m_Head + size - m_Tail <= m_Capacity;
+}
+
+bool RingBuffer::Write(const void* data, jint size)
+{
+	jlong recordSize = AlignRecord(size);
+	if (!m_Data || size < 0 || recordSize > m_Capacity)
+		return false;
+
+	// A record never wraps, the rest of the buffer is skipped instead
+	jint offset = static_cast<jint>(m_Head & (m_Capacity - 1));
+	jlong skip = m_Capacity - offset < recordSize ? m_Capacity - offset : 0;
+	if (!Reserve(skip + recordSize))
+		return false;
+
+	if (skip)
+	{
+		memcpy(m_Data + offset, &kWrapMarker, kRecordHeader);
+		m_Head += skip;
+		offset = 0;
+	}
+	memcpy(m_Data + offset, &size, kRecordHeader);
+	memcpy(m_Data + offset + kRecordHeader, data, size);
+	m_Head += recordSize;
+	return true;
+}
+
+// The JNI call and the volatile store in publish order the record writes before the consumer's read of the head.
+void RingBuffer::Publish()
+{
+	if (!m_Object || m_Head == m_Published)
+		return;
+	static jmethodID publishMID = jni::GetMethodID(s_RingBufferClass, "publish", "(J)V");
+	jni::Op<jvoid>::CallNonVirtualMethod(m_Object, s_RingBufferClass, publishMID, m_Head);
+	m_Published = m_Head;
+}
+
+}
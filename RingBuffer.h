@@ -0,0 +1,43 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+namespace jni
+{
+
+// Producer side of a bitter.jnibridge.RingBuffer, for streaming events to a Java consumer without a JNI call per event.
+// Write only copies into the shared direct buffer, records become visible to Java once Publish (the doorbell) is called,
+// so a producer typically writes a batch of events and then publishes. Only one thread may write at a time.
+class RingBuffer
+{
+public:
+	// Capacity is rounded up to a power of two, a record takes its size plus 4 bytes, padded to 8
+	explicit RingBuffer(jint capacity);
+	~RingBuffer();
+
+	// Returns false (and drops the record) when it doesn't fit, even after the consumer has been asked how far it got
+	bool Write(const void* data, jint size);
+	template <typename T> bool Write(const T& record) { return Write(&record, static_cast<jint>(sizeof(T))); }
+
+	// Makes everything written so far visible and wakes a consumer blocked in await, a no-op when nothing was written
+	void Publish();
+
+	// The bitter.jnibridge.RingBuffer to hand to the consumer, NULL if creating it failed
+	jobject GetJavaObject() const { return m_Object; }
+	jint GetCapacity() const { return m_Capacity; }
+
+private:
+	RingBuffer(const RingBuffer&);
+	RingBuffer& operator = (const RingBuffer&);
+
+	bool Reserve(jlong size);
+
+	jobject m_Object;
+	char* m_Data;
+	jint m_Capacity;
+	jlong m_Head;
+	jlong m_Published;
+	jlong m_Tail;
+};
+
+}
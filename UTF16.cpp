@@ -0,0 +1,116 @@
+#include "UTF16.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define UTF16_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define UTF16_NEON 1
+#endif
+
+namespace jni
+{
+
+static const jchar kReplacementCharacter = 0xFFFD;
+
+// Widens the leading run of ASCII, 16 bytes at a time, and returns how many bytes it consumed
+static size_t WidenAscii(const uint8_t* input, size_t length, jchar* output)
+{
+	size_t i = 0;
+#if UTF16_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+		if (_mm_movemask_epi8(bytes))
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_unpacklo_epi8(bytes, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 8), _mm_unpackhi_epi8(bytes, zero));
+	}
+#elif UTF16_NEON
+	for (; i + 16 <= length; i += 16)
+	{
+		uint8x16_t bytes = vld1q_u8(input + i);
+		uint8x8_t any = vorr_u8(vget_low_u8(bytes), vget_high_u8(bytes));
+		if (vget_lane_u64(vreinterpret_u64_u8(any), 0) & 0x8080808080808080ULL)
+			break;
+		vst1q_u16(output + i, vmovl_u8(vget_low_u8(bytes)));
+		vst1q_u16(output + i + 8, vmovl_u8(vget_high_u8(bytes)));
+	}
+#else
+	for (; i + 8 <= length; i += 8)
+	{
+		uint64_t bytes;
+		memcpy(&bytes, input + i, sizeof(bytes));
+		if (bytes & 0x8080808080808080ULL)
+			break;
+		for (size_t j = 0; j < 8; ++j)
+			output[i + j] = input[i + j];
+	}
+#endif
+	return i;
+}
+
+size_t Utf8ToUtf16(const char* input, size_t length, jchar* output)
+{
+	const uint8_t* in = reinterpret_cast<const uint8_t*>(input);
+	size_t i = 0;
+	size_t n = 0;
+	while (i < length)
+	{
+		if (in[i] < 0x80)
+		{
+			size_t ascii = WidenAscii(in + i, length - i, output + n);
+			i += ascii;
+			n += ascii;
+			// Whatever is left of the run (less than a vector's worth, or up to the first non-ASCII byte)
+			while (i < length && in[i] < 0x80)
+				output[n++] = in[i++];
+			continue;
+		}
+
+		// Sequence length and the valid range of the second byte, which rules out overlongs,
+		// surrogates and code points past U+10FFFF (Unicode table 3-7)
+		uint8_t lead = in[i];
+		size_t count;
+		uint8_t low = 0x80, high = 0xBF;
+		uint32_t c;
+		if (lead >= 0xC2 && lead <= 0xDF)      { count = 2; c = lead & 0x1F; }
+		else if (lead >= 0xE0 && lead <= 0xEF) { count = 3; c = lead & 0x0F; if (lead == 0xE0) low = 0xA0; else if (lead == 0xED) high = 0x9F; }
+		else if (lead >= 0xF0 && lead <= 0xF4) { count = 4; c = lead & 0x07; if (lead == 0xF0) low = 0x90; else if (lead == 0xF4) high = 0x8F; }
+		else
+		{
+			output[n++] = kReplacementCharacter;
+			++i;
+			continue;
+		}
+
+		size_t consumed = 1;
+		for (; consumed < count && i + consumed < length; ++consumed)
+		{
+			uint8_t next = in[i + consumed];
+			if (next < low || next > high)
+				break;
+			c = (c << 6) | (next & 0x3F);
+			low = 0x80;
+			high = 0xBF;
+		}
+		i += consumed;
+
+		if (consumed < count)
+			output[n++] = kReplacementCharacter;
+		else if (c < 0x10000)
+			output[n++] = static_cast<jchar>(c);
+		else
+		{
+			c -= 0x10000;
+			output[n++] = static_cast<jchar>(0xD800 + (c >> 10));
+			output[n++] = static_cast<jchar>(0xDC00 + (c & 0x3FF));
+		}
+	}
+	return n;
+}
+
+}
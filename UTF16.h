@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <jni.h>
+
+namespace jni
+{
+
+// Transcodes standard UTF-8 (not NUL terminated, embedded NULs allowed) to UTF-16 and returns the number of
+// jchars written. output must hold at least length jchars, UTF-16 never needs more units than UTF-8 bytes.
+// Supplementary characters become surrogate pairs, every maximal invalid subsequence becomes U+FFFD.
+size_t Utf8ToUtf16(const char* input, size_t length, jchar* output);
+
+}
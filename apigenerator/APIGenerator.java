@@ -2,7 +2,12 @@
 import java.lang.reflect.*;
 import java.io.*;
 import java.net.*;
+import java.nio.ByteBuffer;
+import java.nio.file.Files;
+import java.security.MessageDigest;
 import java.util.*;
+import java.util.concurrent.*;
+import java.util.concurrent.atomic.AtomicInteger;
 import java.util.jar.*;
 import java.util.regex.*;
 
@@ -19,8 +24,22 @@ public class APIGenerator
 	final Set<Class> m_AllClasses = new TreeSet<Class>(CLASSNAME_COMPARATOR);
 	final Set<Class> m_VisitedClasses = new TreeSet<Class>(CLASSNAME_COMPARATOR);
 	final Set<Class> m_DependencyChain = new LinkedHashSet<Class>();
-
-	static final String k_UsageMessage = "Usage: APIGenerator <dst> [-s] <jarfile[;jarfile;...]> <regex...>\n";
+	final Set<Class> m_StubbedClasses = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+	final List<Pattern> m_StubPatterns = new LinkedList<Pattern>();
+	final Set<Class> m_SnapshotClasses = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+	final List<Pattern> m_SnapshotPatterns = new LinkedList<Pattern>();
+	final Map<Class, Map<String, Object>> m_ConstantValues = new ConcurrentHashMap<Class, Map<String, Object>>();
+	final Map<String, Class> m_ClassesByName = new HashMap<String, Class>();
+	Set<String> m_UsedNames = null;
+	final Set<String> m_WrittenFiles = new HashSet<String>();
+	final Map<Class, String> m_ClassKeys = new HashMap<Class, String>();
+	String m_SettingsKey;
+	final List<Pattern> m_NoCheckPatterns = new ArrayList<Pattern>();
+	boolean m_Inline = false;
+	boolean m_Compact = false;
+	int m_UnityFiles = 0;
+
+	static final String k_UsageMessage = "Usage: APIGenerator <dst> [--stubs <regex[;regex;...]>] [--snapshot <regex[;regex;...]>] [--usage <path[;path;...]>] [--nocheck <file>] [--inline] [--compact] [--unity <n>] [-s] <jarfile[;jarfile;...]> <regex...>\n";
 
 	public static void main(String[] argsArray) throws Exception
 	{
@@ -37,7 +56,48 @@ public class APIGenerator
 			System.err.format("%s: is not a directory.\n", dst);
 			System.exit(1);
 		}
+		APIGenerator generator = new APIGenerator();
 		String nextArgument = args.pollFirst();
+		while (nextArgument != null && nextArgument.startsWith("--"))
+		{
+			if ("--inline".equals(nextArgument) || "--compact".equals(nextArgument))
+			{
+				if ("--inline".equals(nextArgument))
+					generator.m_Inline = true;
+				else
+					generator.m_Compact = true;
+				nextArgument = args.pollFirst();
+				continue;
+			}
+			if (args.isEmpty() || !Arrays.asList("--stubs", "--snapshot", "--usage", "--nocheck", "--unity").contains(nextArgument))
+			{
+				System.err.format(k_UsageMessage);
+				System.exit(1);
+			}
+			if ("--unity".equals(nextArgument))
+			{
+				generator.m_UnityFiles = Integer.parseInt(args.pollFirst());
+				nextArgument = args.pollFirst();
+				continue;
+			}
+			if ("--nocheck".equals(nextArgument))
+			{
+				generator.readNoCheckPatterns(new File(args.pollFirst()));
+				nextArgument = args.pollFirst();
+				continue;
+			}
+			if ("--usage".equals(nextArgument))
+			{
+				for (String path : args.pollFirst().split(";"))
+					generator.collectUsedNames(new File(path));
+				nextArgument = args.pollFirst();
+				continue;
+			}
+			List<Pattern> patterns = "--stubs".equals(nextArgument) ? generator.m_StubPatterns : generator.m_SnapshotPatterns;
+			for (String regex : args.pollFirst().split(";"))
+				patterns.add(Pattern.compile(regex));
+			nextArgument = args.pollFirst();
+		}
 		boolean useSystemClasses = false;
 		if ("-s".equals(nextArgument))
 		{
@@ -95,7 +155,6 @@ public class APIGenerator
 		args.add("::java::lang::NoSuchMethodError");
 		args.add("::java::lang::System");
 
-		APIGenerator generator = new APIGenerator();
 		generator.collectDependencies(jars, args, useSystemClasses);
 		generator.print(dst);
 	}
@@ -194,14 +253,14 @@ public class APIGenerator
 
 		for (Field field : getDeclaredFieldsSorted(clazz))
 		{
-			if (!isValid(field))
+			if (!isGenerated(field))
 				continue;
 			collectDependencies(field.getType());
 		}
 
 		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
-			if (!isValid(method))
+			if (!isGenerated(method) && !isProxied(method))
 				continue;
 			for (Class paramType : method.getParameterTypes())
 				collectDependencies(paramType);
@@ -210,13 +269,82 @@ public class APIGenerator
 
 		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
 		{
-			if (!isValid(constructor))
+			if (!isGenerated(constructor, clazz))
 				continue;
 			for (Class paramType : constructor.getParameterTypes())
 				collectDependencies(paramType);
 		}
 	}
 
+	static final Pattern IDENTIFIER = Pattern.compile("\\w+");
+	static final Set<String> USAGE_EXTENSIONS = new HashSet<String>(Arrays.asList(new String[] {
+		".h", ".hh", ".hpp", ".inl", ".c", ".cc", ".cpp", ".cxx", ".m", ".mm"
+	}));
+
+	// Every identifier in a manifest or source file counts as used, a directory is scanned for sources.
+	// Templates and the names the generated code itself relies on (boxing) are always in.
+	public void collectUsedNames(File path) throws Exception
+	{
+		if (m_UsedNames == null)
+		{
+			m_UsedNames = new HashSet<String>(Arrays.asList(new String[] {
+				"Byte", "Short", "Integer", "Long", "Float", "Double", "Character", "Boolean",
+				"ByteValue", "ShortValue", "IntValue", "LongValue", "FloatValue", "DoubleValue", "CharValue", "BooleanValue"
+			}));
+			collectUsedNames(new File("templates"));
+		}
+		if (path.isDirectory())
+		{
+			File[] files = path.listFiles();
+			Arrays.sort(files);
+			for (File file : files)
+			{
+				String name = file.getName();
+				int extension = name.lastIndexOf('.');
+				if (file.isDirectory() || (extension >= 0 && USAGE_EXTENSIONS.contains(name.substring(extension))))
+					collectUsedNames(file);
+			}
+			return;
+		}
+		if (!path.isFile())
+		{
+			System.err.format("%s: usage path not found\n", path);
+			return;
+		}
+		Matcher matcher = IDENTIFIER.matcher(new String(Files.readAllBytes(path.toPath()), "UTF-8"));
+		while (matcher.find())
+			m_UsedNames.add(matcher.group());
+	}
+
+	// Without --usage all valid members are generated, otherwise only those whose C++ name shows up in the sources.
+	// Classes that are only reached as types end up as opaque declarations without members.
+	private boolean isGenerated(Field field)
+	{
+		return isValid(field) && (m_UsedNames == null || m_UsedNames.contains(getFieldName(field)) || m_UsedNames.contains(getConstantName(field)));
+	}
+
+	private boolean isGenerated(Method method)
+	{
+		return isValid(method) && (m_UsedNames == null || m_UsedNames.contains(getMethodName(method)));
+	}
+
+	// Constructing an object means naming its class
+	private boolean isGenerated(Constructor constructor, Class clazz)
+	{
+		return isValid(constructor, clazz) && (m_UsedNames == null || m_UsedNames.contains(getSimpleName(clazz)));
+	}
+
+	// A native proxy has to implement every method, so an interface that is named keeps them all for its __Proxy
+	private boolean hasProxy(Class clazz)
+	{
+		return clazz.isInterface() && (m_UsedNames == null || m_UsedNames.contains(getSimpleName(clazz)));
+	}
+
+	private boolean isProxied(Method method)
+	{
+		return hasProxy(method.getDeclaringClass()) && isValid(method) && !isStatic(method);
+	}
+
 	private Class collectDirectDependencies(Class clazz) throws Exception
 	{
 		while (clazz.isArray())
@@ -511,39 +639,605 @@ public class APIGenerator
 		return buffer.toString();
 	}
 
+	private String getParametersFromJNIPrimitives(Class<?>[] parameterTypes)
+	{
+		StringBuilder buffer = new StringBuilder();
+		for (int i = 0; i < parameterTypes.length; ++i)
+		{
+			if (i > 0)
+				buffer.append(", ");
+			if (parameterTypes[i].isPrimitive())
+			{
+				buffer.append("jni::FromRawBits< ");
+				buffer.append(getClassName(parameterTypes[i]));
+				buffer.append(" >(primitives[");
+				buffer.append(i);
+				buffer.append("])");
+			}
+			else
+			{
+				buffer.append(getClassName(parameterTypes[i]));
+				buffer.append("(jni::GetObjectArrayElement(args, ");
+				buffer.append(i);
+				buffer.append("))");
+			}
+		}
+		return buffer.toString();
+	}
+
+	private boolean hasPrimitives(Method method)
+	{
+		for (Class paramType : method.getParameterTypes())
+			if (paramType.isPrimitive())
+				return true;
+		Class returnType = method.getReturnType();
+		return returnType.isPrimitive() && returnType != void.class;
+	}
+
 	private void print(String dst) throws Exception
 	{
+		collectStubbedClasses();
+		collectSnapshotClasses();
+		collectClassesByName();
+		m_SettingsKey = getSettingsKey();
+		GenerationCache cache = new GenerationCache(new File(dst));
+		ExecutorService executor = Executors.newFixedThreadPool(Runtime.getRuntime().availableProcessors());
+		List<Future<Void>> tasks = new ArrayList<Future<Void>>();
+
+		if (!m_StubbedClasses.isEmpty())
+		{
+			System.out.println("Generating native stubs");
+			File stubDir = new File(dst, "java/bitter/jnibridge");
+			stubDir.mkdirs();
+			for (final Class clazz : m_StubbedClasses)
+			{
+				tasks.add(generate(executor, cache, new File(stubDir, getStubName(clazz) + ".java"), getClassKey(clazz), new Emitter() {
+					public void emit(PrintStream source) throws Exception { implementStub(source, clazz); }
+				}));
+			}
+		}
+
 		System.out.println("Generating cpp code");
-		// Implement classes
+		// Implement classes, one per file or split evenly over m_UnityFiles translation units
+		List<Class> classes = new ArrayList<Class>(m_VisitedClasses);
+		int nFiles = m_UnityFiles > 0 ? Math.min(m_UnityFiles, classes.size()) : classes.size();
+		for (int i = 0; i < nFiles; ++i)
+		{
+			final List<Class> group = classes.subList(i * classes.size() / nFiles, (i + 1) * classes.size() / nFiles);
+			String fileName = m_UnityFiles > 0 ? String.format("API_Unity%d.cpp", i) : group.get(0).getCanonicalName() + ".cpp";
+			tasks.add(generate(executor, cache, new File(dst, fileName), getGroupKey(group), new Emitter() {
+				public void emit(PrintStream source) throws Exception
+				{
+					Set<Class> dependencies = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+					for (Class clazz : group)
+						dependencies.addAll(getImplementationDependencies(clazz));
+					// With inline members every user has to see their definitions, the sources included
+					for (Class clazz : group)
+					{
+						source.format("#include \"%s\"\n", m_Inline ? getInlineHeaderName(clazz) : getHeaderName(clazz));
+						dependencies.remove(clazz);
+					}
+					for (Class dependency : dependencies)
+						source.format("#include \"%s\"\n", m_Inline ? getInlineHeaderName(dependency) : getHeaderName(dependency));
+					for (Class clazz : group)
+						implementClass(source, clazz);
+				}
+			}));
+		}
+
+		// Inline members go into <class>.inl.h, which pulls in the .inl.h of everything it uses so
+		// no translation unit sees an inline member without its definition. Plain .h files never
+		// include an .inl.h, which keeps every class complete before any inline body is parsed.
+		if (m_Inline)
+		{
+			for (final Class clazz : m_DependencyChain)
+			{
+				tasks.add(generate(executor, cache, new File(dst, getInlineHeaderName(clazz)), getClassKey(clazz), new Emitter() {
+					public void emit(PrintStream header) throws Exception
+					{
+						Set<Class> dependencies = getImplementationDependencies(clazz);
+						header.format("#pragma once\n");
+						header.format("#include \"%s\"\n", getHeaderName(clazz));
+						for (Class dependency : dependencies)
+							header.format("#include \"%s\"\n", getHeaderName(dependency));
+						for (Class dependency : dependencies)
+							header.format("#include \"%s\"\n", getInlineHeaderName(dependency));
+						String namespace = enterNameSpace(header, null, clazz);
+						implementClassMembers(header, clazz, true);
+						closeNameSpace(header, namespace);
+					}
+				}));
+			}
+		}
+
+		// One header per class, which includes its super class and forward declares everything else it mentions
+		System.out.println("Creating header files");
+		for (final Class clazz : m_DependencyChain)
+		{
+			tasks.add(generate(executor, cache, new File(dst, getHeaderName(clazz)), getClassKey(clazz), new Emitter() {
+				public void emit(PrintStream header) throws Exception
+				{
+					header.format("#pragma once\n");
+					header.format("#include \"APIHelper.h\"\n");
+					Class superClass = clazz.isInterface() ? Object.class : clazz.getSuperclass();
+					if (superClass != null)
+						header.format("#include \"%s\"\n", getHeaderName(superClass));
+
+					String currentNameSpace = null;
+					for (Class dependency : getDeclarationDependencies(clazz))
+					{
+						currentNameSpace = enterNameSpace(header, currentNameSpace, dependency);
+						header.format("struct %s;\n", getSimpleName(dependency));
+					}
+					currentNameSpace = enterNameSpace(header, currentNameSpace, clazz);
+					declareClass(header, clazz);
+					closeNameSpace(header, currentNameSpace);
+				}
+			}));
+		}
+
+		// Umbrella header for existing code
+		tasks.add(generate(executor, cache, new File(dst, "API.h"), m_SettingsKey, new Emitter() {
+			public void emit(PrintStream header) throws Exception
+			{
+				header.format("#pragma once\n");
+				header.format("#include \"APIHelper.h\"\n");
+				for (Class clazz : m_VisitedClasses)
+					header.format("#include \"%s\"\n", getHeaderName(clazz));
+				if (m_Inline)
+				{
+					for (Class clazz : m_VisitedClasses)
+						header.format("#include \"%s\"\n", getInlineHeaderName(clazz));
+				}
+			}
+		}));
+
+		try
+		{
+			for (Future<Void> task : tasks)
+				task.get();
+		}
+		catch (ExecutionException e)
+		{
+			throw e.getCause() instanceof Exception ? (Exception)e.getCause() : e;
+		}
+		finally
+		{
+			executor.shutdownNow();
+		}
+		cache.save();
+		System.out.format("%d of %d files up to date\n", cache.getSkippedCount(), tasks.size());
+
+		// Sources left over from an earlier run (a removed class, another output mode) would still get compiled
+		for (File file : new File(dst).listFiles())
+		{
+			String name = file.getName();
+			if (file.isFile() && (name.endsWith(".cpp") || name.endsWith(".h")) && !m_WrittenFiles.contains(name))
+			{
+				System.out.format("Removing stale %s\n", name);
+				file.delete();
+			}
+		}
+	}
+
+	private interface Emitter
+	{
+		void emit(PrintStream out) throws Exception;
+	}
+
+	// Output files are generated concurrently, everything they read from the generator is filled in before print starts
+	private Future<Void> generate(ExecutorService executor, final GenerationCache cache, final File file, final String key, final Emitter emitter)
+	{
+		m_WrittenFiles.add(file.getName());
+		return executor.submit(new Callable<Void>() {
+			public Void call() throws Exception
+			{
+				if (cache.isUpToDate(file, key))
+					return null;
+				ByteArrayOutputStream buffer = new ByteArrayOutputStream();
+				PrintStream out = new PrintStream(buffer);
+				emitter.emit(out);
+				out.close();
+				cache.write(file, key, buffer.toByteArray());
+				return null;
+			}
+		});
+	}
+
+	// Everything besides the class files that changes the output: the generator itself, its options and the set of generated classes and names
+	private String getSettingsKey() throws Exception
+	{
+		MessageDigest digest = MessageDigest.getInstance("SHA-1");
+		updateDigest(digest, getClassFileBytes(APIGenerator.class));
+		updateDigest(digest, String.format("%b %b %d", m_Inline, m_Compact, m_UnityFiles));
+		for (List<Pattern> patterns : Arrays.asList(m_StubPatterns, m_SnapshotPatterns, m_NoCheckPatterns))
+			updateDigest(digest, patterns.toString());
+		for (Set<Class> classes : Arrays.asList(m_VisitedClasses, m_StubbedClasses, m_SnapshotClasses))
+		{
+			for (Class clazz : classes)
+				updateDigest(digest, clazz.getName());
+			updateDigest(digest, "");
+		}
+		if (m_UsedNames != null)
+			updateDigest(digest, new TreeSet<String>(m_UsedNames).toString());
+		return toHex(digest.digest());
+	}
+
+	// A class is regenerated when its class file, a super type's class file or one of their templates changed
+	private String getClassKey(Class clazz) throws Exception
+	{
+		String key = m_ClassKeys.get(clazz);
+		if (key != null)
+			return key;
+		Set<Class> types = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+		collectSuperTypes(types, clazz);
+		MessageDigest digest = MessageDigest.getInstance("SHA-1");
+		updateDigest(digest, m_SettingsKey);
+		for (Class type : types)
+		{
+			updateDigest(digest, type.getName());
+			updateDigest(digest, getClassFileBytes(type));
+			for (String extension : new String[] { ".h", ".cpp" })
+			{
+				File templateFile = new File("templates", type.getName() + extension);
+				if (templateFile.exists())
+					updateDigest(digest, Files.readAllBytes(templateFile.toPath()));
+			}
+		}
+		key = toHex(digest.digest());
+		m_ClassKeys.put(clazz, key);
+		return key;
+	}
+
+	private String getGroupKey(List<Class> group) throws Exception
+	{
+		if (group.size() == 1)
+			return getClassKey(group.get(0));
+		MessageDigest digest = MessageDigest.getInstance("SHA-1");
+		for (Class clazz : group)
+			updateDigest(digest, getClassKey(clazz));
+		return toHex(digest.digest());
+	}
+
+	private static void collectSuperTypes(Set<Class> types, Class clazz)
+	{
+		if (clazz == null || !types.add(clazz))
+			return;
+		collectSuperTypes(types, clazz.getSuperclass());
+		for (Class interfaze : clazz.getInterfaces())
+			collectSuperTypes(types, interfaze);
+	}
+
+	// Classes without a readable class file (some runtime classes) are keyed by the runtime version instead
+	private static byte[] getClassFileBytes(Class clazz) throws IOException
+	{
+		InputStream stream = clazz.getResourceAsStream("/" + clazz.getName().replace('.', '/') + ".class");
+		if (stream == null)
+			return System.getProperty("java.version").getBytes("UTF-8");
+		try
+		{
+			ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+			byte[] buffer = new byte[8192];
+			for (int n = stream.read(buffer); n > 0; n = stream.read(buffer))
+				bytes.write(buffer, 0, n);
+			return bytes.toByteArray();
+		}
+		finally
+		{
+			stream.close();
+		}
+	}
+
+	private static void updateDigest(MessageDigest digest, String value) throws IOException
+	{
+		updateDigest(digest, value.getBytes("UTF-8"));
+	}
+
+	private static void updateDigest(MessageDigest digest, byte[] value)
+	{
+		digest.update(ByteBuffer.allocate(4).putInt(value.length).array());
+		digest.update(value);
+	}
+
+	private static String toHex(byte[] bytes)
+	{
+		StringBuilder hex = new StringBuilder();
+		for (byte b : bytes)
+			hex.append(String.format("%02x", b));
+		return hex.toString();
+	}
+
+	// Per output file the key of the inputs it was generated from and the hash, size and time stamp of what was
+	// written. A file whose key still matches isn't generated again, a file whose content hash didn't change
+	// isn't written again, so its timestamp doesn't trigger a rebuild.
+	private static class GenerationCache
+	{
+		static final String FILE_NAME = ".apigenerator.cache";
+
+		final File m_Directory;
+		final Map<String, String[]> m_Previous = new HashMap<String, String[]>();
+		final Map<String, String[]> m_Current = new ConcurrentHashMap<String, String[]>();
+		final AtomicInteger m_Skipped = new AtomicInteger();
+
+		GenerationCache(File directory) throws IOException
+		{
+			m_Directory = directory;
+			File file = new File(directory, FILE_NAME);
+			if (!file.isFile())
+				return;
+			for (String line : Files.readAllLines(file.toPath(), java.nio.charset.StandardCharsets.UTF_8))
+			{
+				String[] entry = line.split("\t");
+				if (entry.length == 5)
+					m_Previous.put(entry[0], entry);
+			}
+		}
+
+		private String getPath(File file)
+		{
+			return m_Directory.toURI().relativize(file.toURI()).getPath();
+		}
+
+		private boolean matchesFile(String[] entry, File file)
+		{
+			return file.isFile() && file.length() == Long.parseLong(entry[3]) && file.lastModified() == Long.parseLong(entry[4]);
+		}
+
+		boolean isUpToDate(File file, String key)
+		{
+			String path = getPath(file);
+			String[] entry = m_Previous.get(path);
+			if (entry == null || !entry[1].equals(key) || !matchesFile(entry, file))
+				return false;
+			m_Current.put(path, entry);
+			m_Skipped.incrementAndGet();
+			return true;
+		}
+
+		void write(File file, String key, byte[] bytes) throws Exception
+		{
+			String path = getPath(file);
+			String hash = toHex(MessageDigest.getInstance("SHA-1").digest(bytes));
+			String[] entry = m_Previous.get(path);
+			boolean unchanged = entry != null
+				? entry[2].equals(hash) && matchesFile(entry, file)
+				: file.isFile() && file.length() == bytes.length && Arrays.equals(Files.readAllBytes(file.toPath()), bytes);
+			if (!unchanged)
+			{
+				FileOutputStream out = new FileOutputStream(file);
+				out.write(bytes);
+				out.close();
+			}
+			m_Current.put(path, new String[] { path, key, hash, Long.toString(file.length()), Long.toString(file.lastModified()) });
+		}
+
+		int getSkippedCount()
+		{
+			return m_Skipped.get();
+		}
+
+		void save() throws IOException
+		{
+			StringBuilder content = new StringBuilder();
+			for (String[] entry : new TreeMap<String, String[]>(m_Current).values())
+			{
+				content.append(String.join("\t", entry));
+				content.append('\n');
+			}
+			Files.write(new File(m_Directory, FILE_NAME).toPath(), content.toString().getBytes("UTF-8"));
+		}
+	}
+
+	private String getHeaderName(Class clazz)
+	{
+		return clazz.getCanonicalName() + ".h";
+	}
+
+	private String getInlineHeaderName(Class clazz)
+	{
+		return clazz.getCanonicalName() + ".inl.h";
+	}
+
+	// Generated classes mentioned in the class declaration, sorted so the output is stable
+	private Set<Class> getDeclarationDependencies(Class clazz) throws Exception
+	{
+		Set<Class> dependencies = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+		for (Class interfaze : clazz.getInterfaces())
+			addDependency(dependencies, interfaze);
+		for (Field field : getDeclaredFieldsSorted(clazz))
+		{
+			if (isGenerated(field))
+				addDependency(dependencies, field.getType());
+		}
+		for (Method method : getDeclaredMethodsSorted(clazz))
+		{
+			if (!isGenerated(method) && !isProxied(method))
+				continue;
+			addDependency(dependencies, method.getReturnType());
+			for (Class paramType : method.getParameterTypes())
+				addDependency(dependencies, paramType);
+		}
+		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
+		{
+			if (!isGenerated(constructor, clazz))
+				continue;
+			for (Class paramType : constructor.getParameterTypes())
+				addDependency(dependencies, paramType);
+		}
+		addTemplateDependencies(dependencies, new File("templates", clazz.getName() + ".h"));
+		dependencies.remove(clazz);
+		return dependencies;
+	}
+
+	// The implementation needs complete types for everything it converts, including the boxes used by proxies
+	private Set<Class> getImplementationDependencies(Class clazz) throws Exception
+	{
+		Set<Class> dependencies = getDeclarationDependencies(clazz);
+		if (hasProxy(clazz))
+		{
+			for (Method method : getDeclaredMethodsSorted(clazz))
+			{
+				if (!isValid(method) || isStatic(method))
+					continue;
+				addDependency(dependencies, box(method.getReturnType()));
+				for (Class paramType : method.getParameterTypes())
+					addDependency(dependencies, box(paramType));
+			}
+		}
+		addTemplateDependencies(dependencies, new File("templates", clazz.getName() + ".cpp"));
+		dependencies.remove(clazz);
+		return dependencies;
+	}
+
+	private void addDependency(Set<Class> dependencies, Class clazz)
+	{
+		while (clazz.isArray())
+			clazz = clazz.getComponentType();
+		if (m_VisitedClasses.contains(clazz))
+			dependencies.add(clazz);
+	}
+
+	private void collectClassesByName()
+	{
+		if (!m_ClassesByName.isEmpty())
+			return;
 		for (Class clazz : m_VisitedClasses)
+			m_ClassesByName.put(getClassName(clazz), clazz);
+	}
+
+	// Templates are pasted in as is, so pick up the generated classes they name
+	private void addTemplateDependencies(Set<Class> dependencies, File templateFile) throws Exception
+	{
+		if (!templateFile.exists())
+			return;
+		collectClassesByName();
+		Matcher matcher = Pattern.compile("(::\\w+)+").matcher(new String(Files.readAllBytes(templateFile.toPath()), "UTF-8"));
+		while (matcher.find())
 		{
-			PrintStream source = new PrintStream(new FileOutputStream(new File(dst, clazz.getCanonicalName() + ".cpp")));
-			source.format("#include \"API.h\"\n");
-			implementClass(source, clazz);
-			source.close();
+			Class clazz = m_ClassesByName.get(matcher.group());
+			if (clazz != null)
+				dependencies.add(clazz);
 		}
+	}
 
-		System.out.println("Creating header file");
-		PrintStream header = new PrintStream(new FileOutputStream(new File(dst, "API.h")));
-		header.format("#pragma once\n");
-		header.format("#include \"APIHelper.h\"\n");
+	private void collectStubbedClasses()
+	{
+		for (Class clazz : m_VisitedClasses)
+		{
+			if (!hasProxy(clazz))
+				continue;
+			String cppClassName = getClassName(clazz);
+			boolean matches = false;
+			for (Pattern pattern : m_StubPatterns)
+				matches |= pattern.matcher(cppClassName).matches();
+			if (!matches)
+				continue;
+			if (isStubbable(clazz))
+				m_StubbedClasses.add(clazz);
+			else
+				System.err.format("%s: can't generate a native stub, falling back to the reflective proxy\n", cppClassName);
+		}
+	}
 
-		// Declare classes
-		String currentNameSpace = null;
+	private void collectSnapshotClasses()
+	{
 		for (Class clazz : m_VisitedClasses)
 		{
-			currentNameSpace = enterNameSpace(header, currentNameSpace, clazz);
-			header.format("struct %s;\n", getSimpleName(clazz));
+			if (clazz.isInterface() || clazz.isArray())
+				continue;
+			String cppClassName = getClassName(clazz);
+			boolean matches = false;
+			for (Pattern pattern : m_SnapshotPatterns)
+				matches |= pattern.matcher(cppClassName).matches();
+			if (!matches)
+				continue;
+			if (getSnapshotFields(clazz).length > 0)
+				m_SnapshotClasses.add(clazz);
+			else
+				System.err.format("%s: has no public primitive instance fields, skipping snapshot\n", cppClassName);
+		}
+	}
+
+	// Public primitive instance fields, including inherited ones, by name (a hidden field loses to the most derived one)
+	private Field[] getSnapshotFields(Class clazz)
+	{
+		Map<String, Field> fields = new TreeMap<String, Field>();
+		for (Class c = clazz; c != null; c = c.getSuperclass())
+		{
+			for (Field field : getDeclaredFieldsSorted(c))
+			{
+				if (!isPublic(field) || isStatic(field) || field.isSynthetic() || !field.getType().isPrimitive())
+					continue;
+				if (!fields.containsKey(field.getName()))
+					fields.put(field.getName(), field);
+			}
 		}
+		return fields.values().toArray(new Field[fields.size()]);
+	}
 
-		// Define classes
-		for (Class clazz : m_DependencyChain)
+	// The stub only forwards the methods declared by the interface itself, same as its __Proxy
+	private boolean isStubbable(Class clazz)
+	{
+		if (!Modifier.isPublic(clazz.getModifiers()) || clazz.getCanonicalName() == null)
+			return false;
+		for (Method method : clazz.getMethods())
 		{
-			currentNameSpace = enterNameSpace(header, currentNameSpace, clazz);
-			declareClass(header, clazz);
+			if (method.getDeclaringClass() != clazz && !isStatic(method) && !method.isDefault())
+				return false;
 		}
-		currentNameSpace = closeNameSpace(header, currentNameSpace);
-		header.close();
+		return true;
+	}
+
+	private String getStubName(Class clazz)
+	{
+		return "NativeStub_" + clazz.getName().replace('.', '_').replace('$', '_');
+	}
+
+	private String getJavaTypeName(Class clazz)
+	{
+		return clazz.getCanonicalName();
+	}
+
+	private void implementStub(PrintStream out, Class clazz) throws Exception
+	{
+		String stubName = getStubName(clazz);
+		out.format("package bitter.jnibridge;\n\n");
+		out.format("@SuppressWarnings({\"rawtypes\", \"unchecked\"})\n");
+		out.format("final class %s extends JNIBridge.NativeStub implements %s\n{\n", stubName, getJavaTypeName(clazz));
+		out.format("\t%s(final long ptr) { super(ptr); }\n", stubName);
+
+		int i = 0;
+		for (Method method : getDeclaredMethodsSorted(clazz))
+		{
+			if (!isValid(method) || isStatic(method))
+				continue;
+			Class returnType = method.getReturnType();
+			Class[] params = method.getParameterTypes();
+			StringBuilder declaration = new StringBuilder();
+			StringBuilder arguments = new StringBuilder();
+			for (int j = 0; j < params.length; ++j)
+			{
+				declaration.append(j > 0 ? ", " : "").append(getJavaTypeName(params[j])).append(" arg").append(j);
+				arguments.append(", arg").append(j);
+			}
+			String defaultValue = returnType == boolean.class ? "false" : returnType.isPrimitive() ? "0" : "null";
+
+			out.format("\n\t@Override\n\tpublic %s %s(%s)\n\t{\n", getJavaTypeName(returnType), method.getName(), declaration);
+			out.format("\t\tsynchronized (m_InvocationLock)\n\t\t{\n");
+			if (returnType == void.class)
+			{
+				out.format("\t\t\tif (m_Ptr != 0)\n\t\t\t\t$invoke%d(m_Ptr%s);\n", i, arguments);
+			}
+			else
+			{
+				out.format("\t\t\tif (m_Ptr == 0)\n\t\t\t\treturn %s;\n", returnType == char.class ? "(char) 0" : defaultValue);
+				out.format("\t\t\treturn $invoke%d(m_Ptr%s);\n", i, arguments);
+			}
+			out.format("\t\t}\n\t}\n");
+			out.format("\tprivate static native %s $invoke%d(long ptr%s%s);\n",
+				getJavaTypeName(returnType), i++, params.length > 0 ? ", " : "", declaration);
+		}
+		out.format("}\n");
 	}
 
 	private void declareClass(PrintStream header, Class clazz) throws Exception
@@ -559,12 +1253,37 @@ public class APIGenerator
 
 		declareClassMembers(header, clazz);
 
-		if (clazz.isInterface())
+		if (hasProxy(clazz))
 			declareProxy(header, clazz);
 
+		if (m_SnapshotClasses.contains(clazz))
+			declareSnapshot(header, clazz);
+
 		header.format("};\n\n");
 	}
 
+/* example ------------------
+	struct Snapshot
+	{
+		::jint fBottom;
+		::jint fLeft;
+	};
+	bool __Read(Snapshot& snapshot) const;
+*/
+	private void declareSnapshot(PrintStream header, Class clazz) throws Exception
+	{
+		// Classes with a template end in a private section
+		header.format("public:\n");
+		header.format("\tstruct Snapshot\n\t{\n");
+		for (Field field : getSnapshotFields(clazz))
+			header.format("\t\t%s %s;\n", getClassName(field.getType()), getFieldName(field));
+		header.format("\t};\n");
+		header.format("\tbool __Read(Snapshot& snapshot) const;\n");
+		header.format("\tbool __Write(const Snapshot& snapshot) const;\n");
+		header.format("\tstatic bool __Read(jobjectArray objects, Snapshot* snapshots, jsize count);\n");
+		header.format("\tstatic bool __Write(jobjectArray objects, const Snapshot* snapshots, jsize count);\n");
+	}
+
 	private void declareProxy(PrintStream header, Class clazz) throws Exception
 	{
 		header.format("\tstruct __Proxy : public virtual jni::ProxyInvoker\n");
@@ -581,6 +1300,7 @@ public class APIGenerator
 	{
 		out.format("\tprotected:\n");
 		out.format("\t\tbool __TryInvoke(jclass, jmethodID, jobjectArray, bool*, jobject*);\n");
+		out.format("\t\tbool __TryInvokeUnboxed(jclass, jmethodID, jobjectArray, const jlong*, bool*, jobject*, jlong*);\n");
 		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
 			if (!isValid(method) || isStatic(method))
@@ -590,6 +1310,64 @@ public class APIGenerator
 				getMethodName(method),
 				getParameterSignature(method.getParameterTypes()));
 		}
+
+		if (!m_StubbedClasses.contains(clazz))
+			return;
+		out.format("\tpublic:\n");
+		out.format("\t\tstatic jni::Class __STUB_CLASS;\n");
+		out.format("\t\tstatic bool __RegisterStub();\n");
+		out.format("\tprivate:\n");
+		int i = 0;
+		for (Method method : getDeclaredMethodsSorted(clazz))
+		{
+			if (!isValid(method) || isStatic(method))
+				continue;
+			out.format("\t\tstatic %s JNICALL __Stub%d(JNIEnv*, jclass, jlong%s);\n",
+				getStubReturnType(method.getReturnType()),
+				i++,
+				getStubParameterSignature(method.getParameterTypes()));
+		}
+	}
+
+	private String getStubReturnType(Class clazz)
+	{
+		return clazz == void.class ? "void" : getPrimitiveType(clazz);
+	}
+
+	private String getStubParameterSignature(Class<?>[] parameterTypes)
+	{
+		StringBuilder buffer = new StringBuilder();
+		for (int i = 0; i < parameterTypes.length; ++i)
+		{
+			buffer.append(", ");
+			buffer.append(getPrimitiveType(parameterTypes[i]));
+			buffer.append(" arg");
+			buffer.append(i);
+		}
+		return buffer.toString();
+	}
+
+	private String getParametersFromStub(Class<?>[] parameterTypes)
+	{
+		StringBuilder buffer = new StringBuilder();
+		for (int i = 0; i < parameterTypes.length; ++i)
+		{
+			if (i > 0)
+				buffer.append(", ");
+			if (parameterTypes[i].isPrimitive())
+			{
+				buffer.append("arg");
+				buffer.append(i);
+			}
+			else
+			{
+				buffer.append(getClassName(parameterTypes[i]));
+				buffer.append("(arg");
+				buffer.append(i);
+				buffer.append(")");
+			}
+		}
+		return buffer.toString();
 	}
 
 	private void declareClassMembers(PrintStream out, Class clazz) throws Exception
@@ -599,10 +1377,23 @@ public class APIGenerator
 
 /* example ------------------
 	static ::java::util::Comparator& fCASE_INSENSITIVE_ORDER();
+*/
+/* example ------------------
+	static constexpr ::jint kMAX_VALUE = 2147483647;
 */
 		for (Field field : getDeclaredFieldsSorted(clazz))
 		{
-			if (!isValid(field))
+			Object value = getConstantValue(field);
+			if (!isGenerated(field) || value == null)
+				continue;
+			out.format("\tstatic constexpr %s %s = %s;\n",
+				getConstantType(field.getType()),
+				getConstantName(field),
+				getConstantLiteral(field.getType(), value));
+		}
+		for (Field field : getDeclaredFieldsSorted(clazz))
+		{
+			if (!isGenerated(field))
 				continue;
 			out.format("\t%s%s%s %s()%s;\n",
 				isStatic(field) ? "static " : "",
@@ -624,7 +1415,7 @@ public class APIGenerator
 */
 		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
-			if (!isValid(method))
+			if (!isGenerated(method))
 				continue;
 			out.format("\t%s%s %s(%s)%s;\n",
 				isStatic(method) ? "static " : "",
@@ -639,7 +1430,7 @@ public class APIGenerator
 */
 		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
 		{
-			if (!isValid(constructor, clazz))
+			if (!isGenerated(constructor, clazz))
 				continue;
 			Class[] params = constructor.getParameterTypes();
 			out.format("\tstatic jobject __Constructor(%s);\n", getParameterSignature(params));
@@ -691,19 +1482,78 @@ public class APIGenerator
 		for (Class interfaze : clazz.getInterfaces())
 			out.format("%s::operator %s() { return %s((jobject)*this); }\n", getSimpleName(clazz), getClassName(interfaze), getClassName(interfaze));
 
-		implementClassMembers(out, clazz);
+		implementMethodTable(out, clazz);
+		implementClassMembers(out, clazz, false);
 
 		// Apply template
 		File tempalteFile = new File("templates", clazz.getName() + ".cpp");
 		if (tempalteFile.exists())
 			out.format("%s\n",	new Scanner(tempalteFile).useDelimiter("\\Z").next());
 
-		if (clazz.isInterface())
+		if (hasProxy(clazz))
 			implementProxy(out, clazz);
 
+		if (m_SnapshotClasses.contains(clazz))
+			implementSnapshot(out, clazz);
+
 		closeNameSpace(out, namespace);
 	}
 
+	// All fields are moved with raw JNIEnv calls on pre-resolved IDs, which can't throw for a valid object,
+	// so there's a single exception check per call rather than one per field
+	private void implementSnapshot(PrintStream out, Class clazz) throws Exception
+	{
+		String className = getSimpleName(clazz);
+		String snapshotDataNamespace = className + "_snapshot_data";
+		Field[] fields = getSnapshotFields(clazz);
+
+		out.format("namespace %s {\n", snapshotDataNamespace);
+		out.format("static jfieldID fieldIDs[%d];\n", fields.length);
+		out.format("static bool fillFieldIDs()\n{\n");
+		for (int i = 0; i < fields.length; ++i)
+			out.format("\tfieldIDs[%d] = jni::GetFieldID(%s::__CLASS, \"%s\", \"%s\");\n", i, className, fields[i].getName(), getSignature(fields[i]));
+		out.format("\treturn !jni::ExceptionThrown();\n}\n");
+
+		out.format("static void read(JNIEnv* env, jobject object, %s::Snapshot& snapshot)\n{\n", className);
+		for (int i = 0; i < fields.length; ++i)
+			out.format("\tsnapshot.%s = env->Get%sField(object, fieldIDs[%d]);\n", getFieldName(fields[i]), capitalize(fields[i].getType().getName()), i);
+		out.format("}\n");
+
+		out.format("static void write(JNIEnv* env, jobject object, const %s::Snapshot& snapshot)\n{\n", className);
+		for (int i = 0; i < fields.length; ++i)
+		{
+			if (isFinal(fields[i]))
+				continue;
+			out.format("\tenv->Set%sField(object, fieldIDs[%d], snapshot.%s);\n", capitalize(fields[i].getType().getName()), i, getFieldName(fields[i]));
+		}
+		out.format("}\n}\n");
+
+		for (boolean write : new boolean[] { false, true })
+		{
+			String function = write ? "write" : "read";
+			String snapshotType = write ? "const Snapshot" : "Snapshot";
+			out.format("bool %s::__%s(%s& snapshot) const\n{\n", className, capitalize(function), snapshotType);
+			out.format("\tstatic bool fieldIDsFilled = %s::fillFieldIDs();\n", snapshotDataNamespace);
+			out.format("\tJNIEnv* env = jni::AttachCurrentThread();\n");
+			out.format("\tif (!fieldIDsFilled || !env || !m_Object || jni::CheckForExceptionError(env))\n\t\treturn false;\n");
+			out.format("\t%s::%s(env, m_Object, snapshot);\n", snapshotDataNamespace, function);
+			out.format("\treturn !jni::CheckForExceptionError(env);\n}\n");
+
+			// Null elements are skipped, count is clamped to the array length
+			out.format("bool %s::__%s(jobjectArray objects, %s* snapshots, jsize count)\n{\n", className, capitalize(function), snapshotType);
+			out.format("\tstatic bool fieldIDsFilled = %s::fillFieldIDs();\n", snapshotDataNamespace);
+			out.format("\tJNIEnv* env = jni::AttachCurrentThread();\n");
+			out.format("\tif (!fieldIDsFilled || !env || !objects || jni::CheckForExceptionError(env))\n\t\treturn false;\n");
+			out.format("\tif (count > env->GetArrayLength(objects))\n\t\tcount = env->GetArrayLength(objects);\n");
+			out.format("\tfor (jsize i = 0; i < count; ++i)\n\t{\n");
+			out.format("\t\tjobject object = env->GetObjectArrayElement(objects, i);\n");
+			out.format("\t\tif (!object)\n\t\t\tcontinue;\n");
+			out.format("\t\t%s::%s(env, object, snapshots[i]);\n", snapshotDataNamespace, function);
+			out.format("\t\tenv->DeleteLocalRef(object);\n\t}\n");
+			out.format("\treturn !jni::CheckForExceptionError(env);\n}\n");
+		}
+	}
+
 	private void implementProxy(PrintStream out, Class clazz) throws Exception
 	{
 		String className = getSimpleName(clazz);
@@ -725,55 +1575,230 @@ public class APIGenerator
 		{
 			out.format("namespace %s {\n", staticDataNamespace);
 			out.format("static bool methodIDsFilled = false;\n");
-			out.format("static jmethodID methodIDs[%d];\n}\n", nMethods);
+			out.format("static jmethodID methodIDs[%d];\n", nMethods);
+			out.format("static void fillMethodIDs()\n{\n");
+			int i = 0;
+			for (Method method : methods)
+			{
+				if (!isValid(method) || isStatic(method))
+					continue;
+				out.format("\tmethodIDs[%d] = jni::GetMethodID(%s::__CLASS, \"%s\", \"%s\");\n", i, className, method.getName(), getSignature(method));
+				out.format("\tif (jni::ExceptionThrown()) methodIDs[%d] = NULL;\n", i++);
+			}
+			out.format("\t__sync_synchronize();\n");
+			out.format("\tmethodIDsFilled = true;\n}\n}\n");
 		}
+
 		out.format("bool %s::__Proxy::__TryInvoke(jclass clazz, jmethodID methodID, jobjectArray args, bool* success, jobject* result) {\n", className);
+		if (implementProxyPreamble(out, className, staticDataNamespace, nMethods))
+		{
+			int i = 0;
+			for (Method method : methods)
+			{
+				if (!isValid(method) || isStatic(method))
+					continue;
+				Class returnType = method.getReturnType();
+				Class[] params = method.getParameterTypes();
+				if (returnType != void.class)
+					out.format("\tif (%s::methodIDs[%d] == methodID) { *result = jni::NewLocalRef(static_cast< %s >(%s(%s))); *success = true; return true; }\n",
+						staticDataNamespace,
+						i++,
+						getClassName(box(returnType)),
+						getMethodName(method),
+						getParametersFromJNIObjectArray(params));
+				else
+					out.format("\tif (%s::methodIDs[%d] == methodID) { *result = NULL; %s(%s); *success = true; return true; }\n",
+						staticDataNamespace,
+						i++,
+						getMethodName(method),
+						getParametersFromJNIObjectArray(params));
+			}
+			out.format("\treturn false;\n}\n");
+		}
 
-		// early out if there are no methods to invoke
-		if (nMethods == 0) { out.format("\treturn false;\n}"); return; }
+		// Only methods with primitive parameters or results are routed through the unboxed path (see JNIBridge.InterfaceProxy.unboxedSignature)
+		out.format("bool %s::__Proxy::__TryInvokeUnboxed(jclass clazz, jmethodID methodID, jobjectArray args, const jlong* primitives, bool* success, jobject* result, jlong* primitiveResult) {\n", className);
+		if (implementProxyPreamble(out, className, staticDataNamespace, nMethods))
+		{
+			int i = 0;
+			for (Method method : methods)
+			{
+				if (!isValid(method) || isStatic(method))
+					continue;
+				int index = i++;
+				if (!hasPrimitives(method))
+					continue;
+				Class returnType = method.getReturnType();
+				Class[] params = method.getParameterTypes();
+				if (returnType == void.class)
+					out.format("\tif (%s::methodIDs[%d] == methodID) { *result = NULL; %s(%s); *success = true; return true; }\n",
+						staticDataNamespace,
+						index,
+						getMethodName(method),
+						getParametersFromJNIPrimitives(params));
+				else if (returnType.isPrimitive())
+					out.format("\tif (%s::methodIDs[%d] == methodID) { *result = NULL; *primitiveResult = jni::ToRawBits(%s(%s)); *success = true; return true; }\n",
+						staticDataNamespace,
+						index,
+						getMethodName(method),
+						getParametersFromJNIPrimitives(params));
+				else
+					out.format("\tif (%s::methodIDs[%d] == methodID) { *result = jni::NewLocalRef(static_cast< %s >(%s(%s))); *success = true; return true; }\n",
+						staticDataNamespace,
+						index,
+						getClassName(returnType),
+						getMethodName(method),
+						getParametersFromJNIPrimitives(params));
+			}
+			out.format("\treturn false;\n}");
+		}
 
-		// return if success was already achieved
-		out.format("\tif (*success)\n\t\treturn false;\n\n");
+		if (m_StubbedClasses.contains(clazz))
+			implementStubNatives(out, clazz);
+	}
 
-		out.format("\tif (!jni::IsSameObject(clazz, %s::__CLASS))\n\t\treturn false;\n\n", className);
+	private void implementStubNatives(PrintStream out, Class clazz) throws Exception
+	{
+		String className = getSimpleName(clazz);
+		out.format("\njni::Class %s::__Proxy::__STUB_CLASS(\"bitter/jnibridge/%s\");\n", className, getStubName(clazz));
 
-		out.format("\tif (!%s::methodIDsFilled)\n\t{\n", staticDataNamespace);
+		StringBuilder natives = new StringBuilder();
 		int i = 0;
-		for (Method method : methods)
-		{
-			if (!isValid(method) || isStatic(method))
-				continue;
-			out.format("\t\t%s::methodIDs[%d] = jni::GetMethodID(__CLASS, \"%s\", \"%s\");\n", staticDataNamespace, i, method.getName(), getSignature(method));
-			out.format("\t\tif (jni::ExceptionThrown()) %s::methodIDs[%d] = NULL;\n", staticDataNamespace, i++);
-		}
-		out.format("\t\t__sync_synchronize();\n");
-		out.format("\t\t%s::methodIDsFilled = true;\n\t}\n\n", staticDataNamespace);
-
-		i = 0;
-		for (Method method : methods)
+		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
 			if (!isValid(method) || isStatic(method))
 				continue;
 			Class returnType = method.getReturnType();
 			Class[] params = method.getParameterTypes();
-			if (returnType != void.class)
-				out.format("\tif (%s::methodIDs[%d] == methodID) { *result = jni::NewLocalRef(static_cast< %s >(%s(%s))); *success = true; return true; }\n",
-					staticDataNamespace,
-					i++,
-					getClassName(box(returnType)),
+			out.format("%s JNICALL %s::__Proxy::__Stub%d(JNIEnv*, jclass, jlong ptr%s) { ",
+				getStubReturnType(returnType),
+				className,
+				i,
+				getStubParameterSignature(params));
+			if (returnType == void.class)
+				out.format("((__Proxy*) ptr)->%s(%s); }\n",
 					getMethodName(method),
-					getParametersFromJNIObjectArray(params));
+					getParametersFromStub(params));
+			else if (returnType.isPrimitive())
+				out.format("return ((__Proxy*) ptr)->%s(%s); }\n",
+					getMethodName(method),
+					getParametersFromStub(params));
 			else
-				out.format("\tif (%s::methodIDs[%d] == methodID) { *result = NULL; %s(%s); *success = true; return true; }\n",
-					staticDataNamespace,
-					i++,
+				out.format("return static_cast< %s >(jni::NewLocalRef(static_cast< %s >(((__Proxy*) ptr)->%s(%s)))); }\n",
+					getPrimitiveType(returnType),
+					getClassName(returnType),
 					getMethodName(method),
-					getParametersFromJNIObjectArray(params));
+					getParametersFromStub(params));
+			natives.append(String.format("\t\t{ (char*) \"$invoke%d\", (char*) \"(J%s)%s\", (void*) &__Stub%d },\n",
+				i, getSignature(params), getSignature(returnType), i));
+			++i;
+		}
+
+		out.format("bool %s::__Proxy::__RegisterStub()\n{\n", className);
+		if (i == 0)
+		{
+			out.format("\treturn true;\n}\n");
+			return;
+		}
+		out.format("\tstatic JNINativeMethod natives[] = {\n%s\t};\n", natives);
+		out.format("\treturn jni::RegisterNatives(__STUB_CLASS, natives, %d);\n}\n", i);
+	}
+
+	private boolean implementProxyPreamble(PrintStream out, String className, String staticDataNamespace, int nMethods)
+	{
+		// early out if there are no methods to invoke
+		if (nMethods == 0) { out.format("\treturn false;\n}\n"); return false; }
+
+		// return if success was already achieved
+		out.format("\tif (*success)\n\t\treturn false;\n\n");
+
+		out.format("\tif (!jni::IsSameObject(clazz, %s::__CLASS))\n\t\treturn false;\n\n", className);
+
+		out.format("\tif (!%s::methodIDsFilled)\n\t\t%s::fillMethodIDs();\n\n", staticDataNamespace, staticDataNamespace);
+		return true;
+	}
+
+	// Accessors and methods are the hot path, static final fields and constructors always stay out of line.
+	// Compact methods only exist next to their table, so they aren't inlined either.
+	private boolean isInlined(Member member)
+	{
+		return m_Inline && !isStaticFinal(member) && !(member instanceof Constructor) && !(m_Compact && member instanceof Method);
+	}
+
+	// One regex per line, matched against <class>.<method> (e.g. java\.util\.ArrayList\.size or .*\.hashCode), # starts a comment
+	private void readNoCheckPatterns(File file) throws IOException
+	{
+		for (String line : Files.readAllLines(file.toPath(), java.nio.charset.StandardCharsets.UTF_8))
+		{
+			int comment = line.indexOf('#');
+			line = (comment < 0 ? line : line.substring(0, comment)).trim();
+			if (!line.isEmpty())
+				m_NoCheckPatterns.add(Pattern.compile(line));
+		}
+	}
+
+	// Methods listed in the --nocheck file are promised not to throw and skip the exception checks around the call
+	private boolean isUnchecked(Method method, Class clazz)
+	{
+		String name = clazz.getName() + "." + method.getName();
+		for (Pattern pattern : m_NoCheckPatterns)
+		{
+			if (pattern.matcher(name).matches())
+				return true;
+		}
+		return false;
+	}
+
+	// Unchecked methods keep their direct call, the table trampolines always check
+	private boolean isCompact(Method method, Class clazz)
+	{
+		return m_Compact && !isUnchecked(method, clazz);
+	}
+
+	private List<Method> getCompactMethods(Class clazz)
+	{
+		List<Method> methods = new ArrayList<Method>();
+		for (Method method : getDeclaredMethodsSorted(clazz))
+		{
+			if (isGenerated(method) && isCompact(method, clazz))
+				methods.add(method);
 		}
-		out.format("\treturn false;\n}");
+		return methods;
 	}
 
-	private void implementClassMembers(PrintStream out, Class clazz) throws Exception
+/* example ------------------
+namespace Bundle_compact_data {
+static const jni::MethodDescriptor descriptors[] = {
+	{ "getInt", "(Ljava/lang/String;)I", false, 'I' },
+};
+static std::atomic<jmethodID> ids[1];
+static jni::MethodTable table = { Bundle::__CLASS, descriptors, ids };
+}
+*/
+	private void implementMethodTable(PrintStream out, Class clazz) throws Exception
+	{
+		List<Method> methods = getCompactMethods(clazz);
+		if (methods.isEmpty())
+			return;
+		out.format("namespace %s_compact_data {\n", getSimpleName(clazz));
+		out.format("static const jni::MethodDescriptor descriptors[] = {\n");
+		for (Method method : methods)
+		{
+			String returnSignature = getSignature(method.getReturnType());
+			out.format("\t{ \"%s\", \"%s\", %s, '%c' },\n",
+				method.getName(),
+				getSignature(method),
+				isStatic(method) ? "true" : "false",
+				returnSignature.charAt(0) == '[' ? 'L' : returnSignature.charAt(0));
+		}
+		out.format("};\n");
+		out.format("static std::atomic<jmethodID> ids[%d];\n", methods.size());
+		out.format("static jni::MethodTable table = { %s::__CLASS, descriptors, ids };\n", getSimpleName(clazz));
+		out.format("}\n");
+	}
+
+	// Emits either the inline members (into an .inl.h) or the out of line ones
+	private void implementClassMembers(PrintStream out, Class clazz, boolean inlined) throws Exception
 	{
 /* example ------------------
 ::java::util::Comparator& String::fCASE_INSENSITIVE_ORDER()
@@ -782,12 +1807,33 @@ public class APIGenerator
 	static ::java::util::Comparator val = ::java::util::Comparator(jni::Op<jobject>::GetStaticField(__CLASS, fieldID));
 	return val;
 }
+*/
+/* example ------------------
+constexpr ::jint Integer::kMAX_VALUE;
+::jint& Integer::fMAX_VALUE()
+{
+	static ::jint val = ::jint(kMAX_VALUE);
+	return val;
+}
 */
 		for (Field field : getDeclaredFieldsSorted(clazz))
 		{
-			if (!isValid(field))
+			Object value = getConstantValue(field);
+			if (!isGenerated(field) || value == null || inlined)
 				continue;
-			out.format("%s%s %s::%s()%s\n",
+			out.format("constexpr %s %s::%s;\n", getConstantType(field.getType()), getSimpleName(clazz), getConstantName(field));
+			out.format("%s& %s::%s()\n", getClassName(field.getType()), getSimpleName(clazz), getFieldName(field));
+			out.format("{\n");
+			out.format("\tstatic %s val = %s(%s);\n", getClassName(field.getType()), getClassName(field.getType()), getConstantName(field));
+			out.format("\treturn val;\n");
+			out.format("}\n");
+		}
+		for (Field field : getDeclaredFieldsSorted(clazz))
+		{
+			if (!isGenerated(field) || getConstantValue(field) != null || isInlined(field) != inlined)
+				continue;
+			out.format("%s%s%s %s::%s()%s\n",
+				inlined ? "inline " : "",
 				getClassName(field.getType()),
 				isStaticFinal(field) ? "&" : "",
 				getSimpleName(clazz),
@@ -810,7 +1856,8 @@ public class APIGenerator
 
 			if (isFinal(field))
 				continue;
-			out.format("void %s::%s(%s)%s\n",
+			out.format("%svoid %s::%s(%s)%s\n",
+				inlined ? "inline " : "",
 				getSimpleName(clazz),
 				getFieldName(field),
 				getParameterSignature(new Class[] {field.getType()}),
@@ -836,26 +1883,47 @@ jni::Array< ::java::lang::String > String::Split(const ::java::lang::String& arg
 	return jni::Array< ::java::lang::String >(jni::Op<jobjectArray>::CallMethod(m_Object, methodID, (jobject)arg0, arg1));
 }
 */
+		int compactIndex = 0;
 		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
-			if (!isValid(method))
+			if (!isGenerated(method) || isInlined(method) != inlined)
 				continue;
 			Class[] params = method.getParameterTypes();
-			out.format("%s %s::%s(%s)%s\n",
+			out.format("%s%s %s::%s(%s)%s\n",
+				inlined ? "inline " : "",
 				getClassName(method.getReturnType()),
 				getSimpleName(clazz),
 				getMethodName(method),
 				getParameterSignature(params),
 				isStatic(method) ? "" : " const");
 			out.format("{\n");
+			if (isCompact(method, clazz))
+			{
+				// Arrays come back from the jobject trampoline and are cast to their array type
+				Class returnType = method.getReturnType();
+				String callType = returnType.isPrimitive() ? getPrimitiveType(returnType) : "jobject";
+				String call = String.format("jni::Call%sMethod< %s >(%s%s_compact_data::table, %d%s)",
+					isStatic(method) ? "Static" : "",
+					callType,
+					isStatic(method) ? "" : "m_Object, ",
+					getSimpleName(clazz),
+					compactIndex++,
+					getParameterJNINames(params));
+				out.format("\treturn %s(%s);\n",
+					getClassName(returnType),
+					returnType.isArray() ? String.format("static_cast<%s>(%s)", getPrimitiveType(returnType), call) : call);
+				out.format("}\n");
+				continue;
+			}
 			out.format("\tstatic jmethodID methodID = jni::Get%sMethodID(__CLASS, \"%s\", \"%s\");\n",
 				isStatic(method) ? "Static" : "",
 				method.getName(),
 				getSignature(method));
-			out.format("\treturn %s(jni::Op<%s>::Call%sMethod(%s, methodID%s));\n",
+			out.format("\treturn %s(jni::Op<%s>::Call%sMethod%s(%s, methodID%s));\n",
 				getClassName(method.getReturnType()),
 				getPrimitiveType(method.getReturnType()),
 				isStatic(method) ? "Static" : "",
+				isUnchecked(method, clazz) ? "Unchecked" : "",
 				isStatic(method) ? "__CLASS" : "m_Object",
 				getParameterJNINames(params));
 			out.format("}\n");
@@ -870,7 +1938,7 @@ jobject String::__Constructor(const jni::Array< ::jbyte >& arg0, const ::jint& a
 */
 		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
 		{
-			if (!isValid(constructor, clazz))
+			if (!isGenerated(constructor, clazz) || inlined)
 				continue;
 			Class[] params = constructor.getParameterTypes();
 			out.format("jobject %s::__Constructor(%s)\n", getSimpleName(clazz), getParameterSignature(params));
@@ -883,6 +1951,154 @@ jobject String::__Constructor(const jni::Array< ::jbyte >& arg0, const ::jint& a
 		}
 	}
 
+	private String getConstantName(Field field)
+	{
+		return "k" + field.getName().replace('$', '_');
+	}
+
+	private String getConstantType(Class clazz)
+	{
+		return clazz == String.class ? "const char*" : getClassName(clazz);
+	}
+
+	// Java renders floats with enough digits to round trip, which a C++ compiler parses back to the same value
+	private String getConstantLiteral(Class clazz, Object value) throws Exception
+	{
+		if (clazz == String.class)
+			return getStringLiteral((String) value);
+		if (clazz == boolean.class)
+			return ((Integer) value) != 0 ? "true" : "false";
+		if (clazz == long.class)
+		{
+			long longValue = (Long) value;
+			return longValue == Long.MIN_VALUE ? "(-9223372036854775807LL - 1)" : longValue + "LL";
+		}
+		if (clazz == float.class)
+		{
+			float floatValue = (Float) value;
+			if (Float.isNaN(floatValue))
+				return "std::numeric_limits< ::jfloat >::quiet_NaN()";
+			if (Float.isInfinite(floatValue))
+				return (floatValue < 0 ? "-" : "") + "std::numeric_limits< ::jfloat >::infinity()";
+			return Float.toString(floatValue) + "f";
+		}
+		if (clazz == double.class)
+		{
+			double doubleValue = (Double) value;
+			if (Double.isNaN(doubleValue))
+				return "std::numeric_limits< ::jdouble >::quiet_NaN()";
+			if (Double.isInfinite(doubleValue))
+				return (doubleValue < 0 ? "-" : "") + "std::numeric_limits< ::jdouble >::infinity()";
+			return Double.toString(doubleValue);
+		}
+		int intValue = (Integer) value;
+		return intValue == Integer.MIN_VALUE ? "(-2147483647 - 1)" : Integer.toString(intValue);
+	}
+
+	// Modified UTF-8, like the JNI string functions expect, with everything but printable ASCII escaped
+	private String getStringLiteral(String value) throws Exception
+	{
+		ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+		new DataOutputStream(bytes).writeUTF(value);
+		byte[] utf = bytes.toByteArray();
+		StringBuilder buffer = new StringBuilder("\"");
+		for (int i = 2; i < utf.length; ++i)
+		{
+			int c = utf[i] & 0xff;
+			if (c < 0x20 || c > 0x7e || c == '"' || c == '\\' || c == '?')
+				buffer.append(String.format("\\%03o", c));
+			else
+				buffer.append((char) c);
+		}
+		return buffer.append('"').toString();
+	}
+
+	// Only fields with a ConstantValue attribute, static finals initialized in <clinit> still go through JNI
+	private Object getConstantValue(Field field)
+	{
+		if (!isStaticFinal(field) || !(field.getType().isPrimitive() || field.getType() == String.class))
+			return null;
+		Class clazz = field.getDeclaringClass();
+		Map<String, Object> constants = m_ConstantValues.get(clazz);
+		if (constants == null)
+		{
+			constants = readConstantValues(clazz);
+			m_ConstantValues.put(clazz, constants);
+		}
+		return constants.get(field.getName());
+	}
+
+	// Boolean, byte, char and short constants are stored as Integer, like in the class file
+	private static Map<String, Object> readConstantValues(Class clazz)
+	{
+		Map<String, Object> constants = new HashMap<String, Object>();
+		InputStream stream = clazz.getResourceAsStream("/" + clazz.getName().replace('.', '/') + ".class");
+		if (stream == null)
+		{
+			System.err.format("%s: class file not found, constants are read at runtime\n", clazz.getName());
+			return constants;
+		}
+		try
+		{
+			DataInputStream in = new DataInputStream(new BufferedInputStream(stream));
+			in.readInt();				// magic
+			in.readUnsignedShort();		// minor_version
+			in.readUnsignedShort();		// major_version
+
+			int poolCount = in.readUnsignedShort();
+			Object[] pool = new Object[poolCount];
+			int[] strings = new int[poolCount];
+			for (int i = 1; i < poolCount; ++i)
+			{
+				int tag = in.readUnsignedByte();
+				switch (tag)
+				{
+					case 1:  pool[i] = in.readUTF(); break;				// Utf8
+					case 3:  pool[i] = in.readInt(); break;				// Integer
+					case 4:  pool[i] = in.readFloat(); break;			// Float
+					case 5:  pool[i++] = in.readLong(); break;			// Long, takes two entries
+					case 6:  pool[i++] = in.readDouble(); break;		// Double, takes two entries
+					case 8:  strings[i] = in.readUnsignedShort(); break;	// String
+					case 7: case 16: case 19: case 20: in.readUnsignedShort(); break;	// Class, MethodType, Module, Package
+					case 15: in.readUnsignedByte(); in.readUnsignedShort(); break;		// MethodHandle
+					case 9: case 10: case 11: case 12: case 17: case 18: in.readInt(); break;	// Member refs, NameAndType, Dynamic, InvokeDynamic
+					default: throw new IOException("unknown constant pool tag " + tag);
+				}
+			}
+
+			in.readUnsignedShort();		// access_flags
+			in.readUnsignedShort();		// this_class
+			in.readUnsignedShort();		// super_class
+			in.skipBytes(2 * in.readUnsignedShort());	// interfaces
+
+			int fieldCount = in.readUnsignedShort();
+			for (int i = 0; i < fieldCount; ++i)
+			{
+				in.readUnsignedShort();	// access_flags
+				String name = (String) pool[in.readUnsignedShort()];
+				in.readUnsignedShort();	// descriptor_index
+				int attributeCount = in.readUnsignedShort();
+				for (int j = 0; j < attributeCount; ++j)
+				{
+					String attribute = (String) pool[in.readUnsignedShort()];
+					byte[] info = new byte[in.readInt()];
+					in.readFully(info);
+					if (!"ConstantValue".equals(attribute))
+						continue;
+					int index = ((info[0] & 0xff) << 8) | (info[1] & 0xff);
+					constants.put(name, strings[index] != 0 ? pool[strings[index]] : pool[index]);
+				}
+			}
+			in.close();
+		}
+		catch (IOException e)
+		{
+			System.err.format("%s: can't parse class file (%s), constants are read at runtime\n", clazz.getName(), e.getMessage());
+			constants.clear();
+		}
+		return constants;
+	}
+
 	public static Field[] getDeclaredFieldsSorted(Class clazz)
 	{
 		Field[] fields = clazz.getDeclaredFields();
@@ -2,47 +2,513 @@ package bitter.jnibridge;
 
 import java.lang.reflect.*;
 import java.lang.invoke.*;
+import java.nio.BufferOverflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.Charset;
+import java.util.ArrayDeque;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.Collection;
+import java.util.Enumeration;
+import java.util.HashMap;
+import java.util.Iterator;
+import java.util.List;
+import java.util.Map;
+import java.util.Properties;
+import java.util.Set;
+import java.util.concurrent.ConcurrentHashMap;
 
 public class JNIBridge
 {
 	static native Object invoke(long ptr, Class clazz, Method method, Object[] args);
+	static native Object invokeUnboxed(long ptr, Class clazz, Method method, Object[] args, long[] primitives);
+	static native void invokeAsync(long ptr, Class clazz, Method method, Object[] args);
+	static native void invokeDisabled(long statistics);
 
-	static Object newInterfaceProxy(final long ptr, final Class[] interfaces)
+	// Returned by invoke and invokeUnboxed when the native proxy doesn't implement the method
+	static final Object NOT_HANDLED = new Object();
+
+	private static final Map<List<Class>, ProxyFactory> s_ProxyFactories = new ConcurrentHashMap<List<Class>, ProxyFactory>();
+
+	static Object newInterfaceProxy(final long ptr, final long statistics, final boolean async, final Class[] interfaces) throws Exception
+	{
+		List<Class> key = Arrays.asList(interfaces);
+		ProxyFactory factory = s_ProxyFactories.get(key);
+		if (factory == null)
+		{
+			factory = new ProxyFactory(interfaces);
+			ProxyFactory existing = s_ProxyFactories.putIfAbsent(key, factory);
+			if (existing != null)
+				factory = existing;
+		}
+		return factory.newInstance(ptr, statistics, async);
+	}
+
+	private static final Map<Method, char[]> s_BatchSignatures = new ConcurrentHashMap<Method, char[]>();
+
+	private static char[] batchParameters(final Method method)
+	{
+		char[] parameters = s_BatchSignatures.get(method);
+		if (parameters == null)
+		{
+			Class<?>[] params = method.getParameterTypes();
+			parameters = new char[params.length];
+			for (int i = 0; i < params.length; ++i)
+				parameters[i] = InterfaceProxy.typeCode(params[i]);
+			s_BatchSignatures.put(method, parameters);
+		}
+		return parameters;
+	}
+
+	// Parameter type codes of a method recorded by jni::Batch, so it knows how to read the arguments
+	static String batchSignature(final Method method)
+	{
+		return new String(batchParameters(method));
+	}
+
+	// Replays calls recorded by jni::Batch, see Batch::CallV for the command layout.
+	// Returns the index of the first failed call, whose Throwable is stored in results, or -1.
+	static int executeBatch(final Object[] objects, final long[] primitives, final int[] commands, final Object[] results)
+	{
+		int position = 0;
+		for (int i = 0; position < commands.length; ++i)
+		{
+			int target = commands[position++];
+			Method method = (Method) objects[commands[position++]];
+			char[] parameters = batchParameters(method);
+			Object[] args = new Object[parameters.length];
+			for (int j = 0; j < parameters.length; ++j)
+			{
+				int index = commands[position++];
+				args[j] = parameters[j] == 'L' ? objects[index] : InterfaceProxy.fromRawBits(parameters[j], primitives[index]);
+			}
+
+			try
+			{
+				results[i] = method.invoke(target < 0 ? null : objects[target], args);
+			}
+			catch (InvocationTargetException e)
+			{
+				results[i] = e.getCause();
+				return i;
+			}
+			catch (Throwable t)
+			{
+				results[i] = t;
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	private static final Charset UTF_8 = Charset.forName("UTF-8");
+	private static final ThreadLocal<ByteBuffer> s_MarshalBuffer = new ThreadLocal<ByteBuffer>()
+	{
+		@Override protected ByteBuffer initialValue() { return ByteBuffer.allocateDirect(4096).order(ByteOrder.nativeOrder()); }
+	};
+
+	// Serializes a Map, Properties or Collection for jni::ToNative, see Marshal.cpp for the layout.
+	// The buffer is reused per thread and only valid until the next call, returns null for other containers.
+	static ByteBuffer marshal(final Object container, final boolean asStrings)
+	{
+		ByteBuffer buffer = s_MarshalBuffer.get();
+		while (true)
+		{
+			try
+			{
+				buffer.clear();
+				buffer.putInt(0);
+				if (container instanceof Properties)
+				{
+					Properties properties = (Properties) container;
+					Set<String> names = properties.stringPropertyNames();
+					buffer.put((byte) 'M').putInt(names.size());
+					for (String name : names)
+					{
+						marshalValue(buffer, name, true);
+						marshalValue(buffer, properties.getProperty(name), asStrings);
+					}
+				}
+				else if (container instanceof Map)
+				{
+					Map<?, ?> map = (Map<?, ?>) container;
+					buffer.put((byte) 'M').putInt(map.size());
+					for (Map.Entry<?, ?> entry : map.entrySet())
+					{
+						marshalValue(buffer, String.valueOf(entry.getKey()), true);
+						marshalValue(buffer, entry.getValue(), asStrings);
+					}
+				}
+				else if (container instanceof Collection)
+				{
+					Collection<?> collection = (Collection<?>) container;
+					buffer.put((byte) 'L').putInt(collection.size());
+					for (Object value : collection)
+						marshalValue(buffer, value, asStrings);
+				}
+				else
+					return null;
+				buffer.putInt(0, buffer.position());
+				return buffer;
+			}
+			catch (BufferOverflowException e)
+			{
+				buffer = ByteBuffer.allocateDirect(buffer.capacity() * 2).order(ByteOrder.nativeOrder());
+				s_MarshalBuffer.set(buffer);
+			}
+		}
+	}
+
+	private static void marshalValue(final ByteBuffer buffer, final Object value, final boolean asString)
 	{
-		return Proxy.newProxyInstance(JNIBridge.class.getClassLoader(), interfaces, new InterfaceProxy(ptr));
+		if (value == null)
+			buffer.put((byte) 'N');
+		else if (!asString && value instanceof Boolean)
+			buffer.put((byte) 'Z').put((byte) (((Boolean) value) ? 1 : 0));
+		else if (!asString && value instanceof Byte)
+			buffer.put((byte) 'B').put((Byte) value);
+		else if (!asString && value instanceof Character)
+			buffer.put((byte) 'C').putChar((Character) value);
+		else if (!asString && value instanceof Short)
+			buffer.put((byte) 'S').putShort((Short) value);
+		else if (!asString && value instanceof Integer)
+			buffer.put((byte) 'I').putInt((Integer) value);
+		else if (!asString && value instanceof Long)
+			buffer.put((byte) 'J').putLong((Long) value);
+		else if (!asString && value instanceof Float)
+			buffer.put((byte) 'F').putFloat((Float) value);
+		else if (!asString && value instanceof Double)
+			buffer.put((byte) 'D').putDouble((Double) value);
+		else
+		{
+			byte[] bytes = String.valueOf(value).getBytes(UTF_8);
+			buffer.put((byte) 'T').putInt(bytes.length).put(bytes);
+		}
+	}
+
+	// Builds a HashMap or ArrayList from a buffer written by jni::ToJavaMap/ToJavaList
+	static Object unmarshal(final ByteBuffer buffer)
+	{
+		buffer.order(ByteOrder.nativeOrder());
+		byte kind = buffer.get();
+		int count = buffer.getInt();
+		if (kind == 'M')
+		{
+			HashMap<Object, Object> map = new HashMap<Object, Object>(count * 4 / 3 + 1);
+			for (int i = 0; i < count; ++i)
+			{
+				Object key = unmarshalValue(buffer);
+				map.put(key, unmarshalValue(buffer));
+			}
+			return map;
+		}
+		ArrayList<Object> list = new ArrayList<Object>(count);
+		for (int i = 0; i < count; ++i)
+			list.add(unmarshalValue(buffer));
+		return list;
+	}
+
+	private static Object unmarshalValue(final ByteBuffer buffer)
+	{
+		switch (buffer.get())
+		{
+			case 'Z': return buffer.get() != 0;
+			case 'B': return buffer.get();
+			case 'C': return buffer.getChar();
+			case 'S': return buffer.getShort();
+			case 'I': return buffer.getInt();
+			case 'J': return buffer.getLong();
+			case 'F': return buffer.getFloat();
+			case 'D': return buffer.getDouble();
+			case 'T':
+			{
+				byte[] bytes = new byte[buffer.getInt()];
+				buffer.get(bytes);
+				return new String(bytes, UTF_8);
+			}
+			default: return null;
+		}
+	}
+
+	// Source of a jni::ChunkedRange, an Iterator or Enumeration as is or the iterator() of an Iterable
+	static Object iterate(final Object source)
+	{
+		if (source instanceof Iterable)
+			return ((Iterable<?>) source).iterator();
+		if (source instanceof Iterator || source instanceof Enumeration)
+			return source;
+		throw new IllegalArgumentException("Not an Iterable, Iterator or Enumeration: " + source.getClass().getName());
+	}
+
+	// Copies up to chunk.length elements for jni::ChunkedRange, a short count means the source is exhausted
+	static int fillChunk(final Object source, final Object[] chunk)
+	{
+		int count = 0;
+		if (source instanceof Iterator)
+		{
+			Iterator<?> iterator = (Iterator<?>) source;
+			while (count < chunk.length && iterator.hasNext())
+				chunk[count++] = iterator.next();
+		}
+		else
+		{
+			Enumeration<?> enumeration = (Enumeration<?>) source;
+			while (count < chunk.length && enumeration.hasMoreElements())
+				chunk[count++] = enumeration.nextElement();
+		}
+		if (count < chunk.length)
+			Arrays.fill(chunk, count, chunk.length, null);
+		return count;
 	}
 
 	static void disableInterfaceProxy(final Object proxy)
 	{
-		if (proxy != null)
-			((InterfaceProxy) Proxy.getInvocationHandler(proxy)).disable();
+		if (proxy instanceof NativeStub)
+			((NativeStub) proxy).disable();
+		else if (proxy != null)
+			((ProxyBinding) Proxy.getInvocationHandler(proxy)).disable();
+	}
+
+	static void recycleInterfaceProxy(final Object proxy)
+	{
+		if (proxy instanceof NativeStub)
+			((NativeStub) proxy).disable();
+		else if (proxy != null)
+			((ProxyBinding) Proxy.getInvocationHandler(proxy)).recycle();
+	}
+
+	// Base class of the NativeStub_* classes generated by APIGenerator --stubs.
+	// Their interface methods call natives registered by the C++ side, passing m_Ptr along.
+	static abstract class NativeStub
+	{
+		protected final Object m_InvocationLock = new Object[0];
+		protected long m_Ptr;
+
+		protected NativeStub(final long ptr)
+		{
+			m_Ptr = ptr;
+		}
+
+		public void disable()
+		{
+			synchronized (m_InvocationLock)
+			{
+				m_Ptr = 0;
+			}
+		}
+	}
+
+	// Caches the proxy class constructor for one set of interfaces and keeps a few disabled handlers around for reuse
+	private static class ProxyFactory
+	{
+		private static final int kMaxPooledProxies = 16;
+
+		private static final MethodType kDefaultMethodType = MethodType.methodType(Object.class, Object.class, Object[].class);
+
+		private final Constructor<?> m_Constructor;
+		private final ArrayDeque<InterfaceProxy> m_Pool = new ArrayDeque<InterfaceProxy>();
+		private final Map<Method, MethodHandle> m_DefaultMethods = new ConcurrentHashMap<Method, MethodHandle>();
+
+		@SuppressWarnings("deprecation")
+		public ProxyFactory(final Class[] interfaces) throws NoSuchMethodException
+		{
+			m_Constructor = Proxy.getProxyClass(JNIBridge.class.getClassLoader(), interfaces).getConstructor(InvocationHandler.class);
+		}
+
+		// Every proxy handed out is a new object, only the handler behind it is reused, so a stale reference
+		// to the proxy of a recycled handler can't reach the native object the handler serves now
+		public Object newInstance(final long ptr, final long statistics, final boolean async) throws Exception
+		{
+			InterfaceProxy handler;
+			synchronized (m_Pool)
+			{
+				handler = m_Pool.pollFirst();
+			}
+			if (handler == null)
+				handler = new InterfaceProxy(this);
+			return m_Constructor.newInstance(new ProxyBinding(handler, handler.enable(ptr, statistics, async), statistics));
+		}
+
+		// (Object proxy, Object[] args)Object handle calling the interface implementation of a default method on this proxy class
+		public MethodHandle defaultMethod(final Object proxy, final Method m) throws ReflectiveOperationException
+		{
+			MethodHandle method = m_DefaultMethods.get(m);
+			if (method != null)
+				return method;
+
+			Class<?>[] params = m.getParameterTypes();
+			method = MethodHandles.lookup()
+				.findSpecial(m.getDeclaringClass(), m.getName(), MethodType.methodType(m.getReturnType(), params), proxy.getClass())
+				.asSpreader(Object[].class, params.length)
+				.asType(kDefaultMethodType);
+			m_DefaultMethods.put(m, method);
+			return method;
+		}
+
+		public void recycle(final InterfaceProxy handler)
+		{
+			synchronized (m_Pool)
+			{
+				if (m_Pool.size() < kMaxPooledProxies)
+					m_Pool.addFirst(handler);
+			}
+		}
+	}
+
+	// The handler of one proxy instance, it only reaches the InterfaceProxy while that is still enabled for it
+	private static final class ProxyBinding implements InvocationHandler
+	{
+		private final InterfaceProxy m_Handler;
+		private final int m_Generation;
+		private final long m_Statistics;
+
+		ProxyBinding(final InterfaceProxy handler, final int generation, final long statistics)
+		{
+			m_Handler = handler;
+			m_Generation = generation;
+			m_Statistics = statistics;
+		}
+
+		public Object invoke(Object proxy, Method method, Object[] args) throws Throwable
+		{
+			return m_Handler.invoke(m_Generation, m_Statistics, proxy, method, args);
+		}
+
+		void disable()
+		{
+			m_Handler.disable(m_Generation);
+		}
+
+		void recycle()
+		{
+			if (m_Handler.disable(m_Generation))
+				m_Handler.m_Factory.recycle(m_Handler);
+		}
 	}
 
-	private static class InterfaceProxy implements InvocationHandler
+	private static class InterfaceProxy
 	{
+		// One type code per parameter followed by the return type code, or NO_PRIMITIVES for methods without primitives
+		private static final char[] NO_PRIMITIVES = new char[0];
+		private static final Object[] NO_ARGS = new Object[0];
+		private static final Map<Method, char[]> s_UnboxedSignatures = new ConcurrentHashMap<Method, char[]>();
+		private static final ThreadLocal<long[]> s_Primitives = new ThreadLocal<long[]>()
+		{
+			@Override
+			protected long[] initialValue()
+			{
+				return new long[8];
+			}
+		};
+
 		private Object m_InvocationLock = new Object[0];
+		private final ProxyFactory m_Factory;
 		private long m_Ptr;
+		private int m_Generation;
+		private boolean m_Async;
 
-		@SuppressWarnings("unused")
-		public InterfaceProxy(final long ptr)
+		public InterfaceProxy(final ProxyFactory factory)
 		{
-			m_Ptr = ptr;
+			m_Factory = factory;
 		}
 
-		private Object invokeDefault(Object proxy, Throwable t, Method m, Object[] args) throws Throwable
+		private static char typeCode(Class<?> clazz)
 		{
-			if (args == null)
+			if (!clazz.isPrimitive())	return 'L';
+			if (clazz == boolean.class)	return 'Z';
+			if (clazz == byte.class)	return 'B';
+			if (clazz == char.class)	return 'C';
+			if (clazz == short.class)	return 'S';
+			if (clazz == int.class)		return 'I';
+			if (clazz == long.class)	return 'J';
+			if (clazz == float.class)	return 'F';
+			if (clazz == double.class)	return 'D';
+			return 'V';
+		}
+
+		private static char[] unboxedSignature(Method method)
+		{
+			char[] signature = s_UnboxedSignatures.get(method);
+			if (signature != null)
+				return signature;
+
+			Class<?>[] params = method.getParameterTypes();
+			signature = new char[params.length + 1];
+			boolean hasPrimitives = false;
+			for (int i = 0; i < params.length; ++i)
+				hasPrimitives |= (signature[i] = typeCode(params[i])) != 'L';
+			signature[params.length] = typeCode(method.getReturnType());
+			hasPrimitives |= signature[params.length] != 'L' && signature[params.length] != 'V';
+
+			if (!hasPrimitives)
+				signature = NO_PRIMITIVES;
+			s_UnboxedSignatures.put(method, signature);
+			return signature;
+		}
+
+		private static long toRawBits(char type, Object value)
+		{
+			switch (type)
 			{
-				args = new Object[0];
+				case 'Z': return ((Boolean) value).booleanValue() ? 1 : 0;
+				case 'B': return ((Byte) value).byteValue();
+				case 'C': return ((Character) value).charValue();
+				case 'S': return ((Short) value).shortValue();
+				case 'I': return ((Integer) value).intValue();
+				case 'J': return ((Long) value).longValue();
+				case 'F': return Float.floatToRawIntBits(((Float) value).floatValue());
+				case 'D': return Double.doubleToRawLongBits(((Double) value).doubleValue());
 			}
-			Class<?> k = m.getDeclaringClass();
+			return 0;
+		}
+
+		private static Object fromRawBits(char type, long bits)
+		{
+			switch (type)
+			{
+				case 'Z': return Boolean.valueOf(bits != 0);
+				case 'B': return Byte.valueOf((byte) bits);
+				case 'C': return Character.valueOf((char) bits);
+				case 'S': return Short.valueOf((short) bits);
+				case 'I': return Integer.valueOf((int) bits);
+				case 'J': return Long.valueOf(bits);
+				case 'F': return Float.valueOf(Float.intBitsToFloat((int) bits));
+				case 'D': return Double.valueOf(Double.longBitsToDouble(bits));
+			}
+			return null;
+		}
+
+		// Primitive arguments travel as raw bits in a per-thread long[], the native side writes a primitive result back into slot 0
+		private Object invokeUnboxed(char[] signature, Method method, Object[] args)
+		{
+			int nParams = signature.length - 1;
+			long[] primitives = s_Primitives.get();
+			if (primitives.length < nParams)
+			{
+				primitives = new long[Math.max(nParams, primitives.length * 2)];
+				s_Primitives.set(primitives);
+			}
+
+			for (int i = 0; i < nParams; ++i)
+				if (signature[i] != 'L')
+					primitives[i] = toRawBits(signature[i], args[i]);
+
+			Object result = JNIBridge.invokeUnboxed(m_Ptr, method.getDeclaringClass(), method, args, primitives);
+			char returnType = signature[nParams];
+			return returnType == 'L' || result == JNIBridge.NOT_HANDLED ? result : fromRawBits(returnType, primitives[0]);
+		}
+
+		private Object invokeDefault(Object proxy, Method m, Object[] args) throws Throwable
+		{
+			// isDefault() is only available since API 24, but this code path is not hit on lower ones as we generate methods for everything
+			if (!m.isDefault())
+				throw new NoSuchMethodError(m.toString());
 
 			MethodHandle method;
 			try
 			{
-				method = MethodHandles.lookup()
-					.findSpecial(k, m.getName(), MethodType.methodType(m.getReturnType(), m.getParameterTypes()), proxy.getClass())
-					.bindTo(proxy);
+				method = m_Factory.defaultMethod(proxy, m);
 			}
 			catch (Exception e)
 			{
@@ -50,40 +516,60 @@ public class JNIBridge
 				return null;
 			}
 
-			return method.invokeWithArguments(args);
+			return (Object) method.invokeExact(proxy, args == null ? NO_ARGS : args);
 		}
 
-		public Object invoke(Object proxy, Method method, Object[] args) throws Throwable
+		public Object invoke(int generation, long statistics, Object proxy, Method method, Object[] args) throws Throwable
 		{
 			synchronized (m_InvocationLock)
 			{
-				if (m_Ptr == 0)
-					return null;
-
-				try
+				if (m_Ptr == 0 || generation != m_Generation)
 				{
-					return JNIBridge.invoke(m_Ptr, method.getDeclaringClass(), method, args);
+					// Native statistics are static per proxy type and outlive the native proxy
+					if (statistics != 0)
+						JNIBridge.invokeDisabled(statistics);
+					return null;
 				}
-				catch (NoSuchMethodError e)
+
+				// Queued on the native side. Default methods may not be implemented there, they stay synchronous so
+				// an unhandled call can still fall back to the interface's implementation
+				if (m_Async && method.getReturnType() == void.class && Modifier.isAbstract(method.getModifiers()))
 				{
-					// isDefault() is only available since API 24, but this code path is not hit on lower ones as we generate methods for everything
-					if (method.isDefault())
-						return invokeDefault(proxy, e, method, args);
-					else
-					{
-						System.err.println("JNIBridge error: Java interface default methods are only supported since Android Oreo");
-						throw e;
-					}
+					JNIBridge.invokeAsync(m_Ptr, method.getDeclaringClass(), method, args);
+					return null;
 				}
+
+				char[] signature = unboxedSignature(method);
+				Object result = signature != NO_PRIMITIVES
+					? invokeUnboxed(signature, method, args)
+					: JNIBridge.invoke(m_Ptr, method.getDeclaringClass(), method, args);
+				if (result != JNIBridge.NOT_HANDLED)
+					return result;
+				return invokeDefault(proxy, method, args);
 			}
 		}
 
-		public void disable()
+		// Returns the generation the new proxy instance is bound to
+		public int enable(final long ptr, final long statistics, final boolean async)
+		{
+			synchronized (m_InvocationLock)
+			{
+				m_Ptr = ptr;
+				m_Async = async;
+				return ++m_Generation;
+			}
+		}
+
+		// Only the proxy instance of the current generation may disable, returns whether it did
+		public boolean disable(final int generation)
 		{
 			synchronized (m_InvocationLock)
 			{
+				if (generation != m_Generation || m_Ptr == 0)
+					return false;
 				m_Ptr = 0;
+				return true;
 			}
 		}
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,48 @@
+package bitter.jnibridge;
+
+import java.io.Closeable;
+import java.nio.ByteBuffer;
+
+// A file mapped by native code (see MappedBuffer.h). Holds one reference to the mapping until close(),
+// whether or not the buffer or any view made from it (duplicate, slice, ...) is still reachable, as views
+// don't keep the buffer they were made from alive on Android. Neither may be used after close().
+public final class MappedBuffer implements Closeable
+{
+	private final ByteBuffer m_Buffer;
+	private long m_Handle;
+
+	private MappedBuffer(ByteBuffer buffer, long handle)
+	{
+		m_Buffer = buffer;
+		m_Handle = handle;
+	}
+
+	static MappedBuffer create(ByteBuffer buffer, long handle)
+	{
+		return new MappedBuffer(buffer, handle);
+	}
+
+	// Direct buffer over the mapping, read-only if it was mapped read-only
+	public synchronized ByteBuffer buffer()
+	{
+		if (m_Handle == 0)
+			throw new IllegalStateException("MappedBuffer is closed");
+		return m_Buffer;
+	}
+
+	public synchronized boolean isClosed()
+	{
+		return m_Handle == 0;
+	}
+
+	// The file is unmapped once native code is done with it as well. Never closing keeps it mapped.
+	@Override public synchronized void close()
+	{
+		if (m_Handle == 0)
+			return;
+		release(m_Handle);
+		m_Handle = 0;
+	}
+
+	private static native void release(long handle);
+}
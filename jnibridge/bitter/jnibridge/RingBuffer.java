@@ -0,0 +1,143 @@
+package bitter.jnibridge;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+// Single producer, single consumer ring of records written by native code (see RingBuffer.h).
+// Records are copied into the direct buffer without any JNI call, the producer only calls publish
+// now and then, which makes everything written so far visible and wakes a waiting consumer, and
+// consumed when it runs out of space. A record is a native order int size followed by the bytes,
+// padded to 8 bytes. A negative size marks the unused end of the buffer before it wraps around.
+public final class RingBuffer
+{
+	public interface Handler
+	{
+		// The record is only valid during the call
+		void onRecord(ByteBuffer record);
+	}
+
+	private final ByteBuffer m_Buffer;
+	private final ByteBuffer m_Record;
+	private final int m_Mask;
+
+	// Written by the producer through publish, read by the consumer
+	private volatile long m_Head;
+	// Written by the consumer once it's done with everything before it, read by the producer through consumed
+	private volatile long m_Tail;
+	private volatile boolean m_Waiting;
+	private volatile boolean m_Closed;
+
+	// Consumer side only
+	private long m_Read;
+	private long m_Available;
+
+	private RingBuffer(int capacity)
+	{
+		m_Buffer = ByteBuffer.allocateDirect(capacity).order(ByteOrder.nativeOrder());
+		m_Record = m_Buffer.duplicate().order(ByteOrder.nativeOrder());
+		m_Mask = capacity - 1;
+	}
+
+	// capacity has to be a power of two, the producer keeps the buffer (and with it the memory) alive
+	static RingBuffer create(int capacity)
+	{
+		return new RingBuffer(capacity);
+	}
+
+	ByteBuffer buffer()
+	{
+		return m_Buffer;
+	}
+
+	void publish(long head)
+	{
+		m_Head = head;
+		if (m_Waiting)
+		{
+			synchronized (this)
+			{
+				notifyAll();
+			}
+		}
+	}
+
+	long consumed()
+	{
+		return m_Tail;
+	}
+
+	void close()
+	{
+		m_Closed = true;
+		synchronized (this)
+		{
+			notifyAll();
+		}
+	}
+
+	public boolean isClosed()
+	{
+		return m_Closed;
+	}
+
+	// Returns the next published record, valid until the following call, or null when there is none.
+	// Space is handed back to the producer whenever the records published so far have been read.
+	public ByteBuffer next()
+	{
+		while (true)
+		{
+			if (m_Read == m_Available)
+			{
+				m_Tail = m_Read;
+				m_Available = m_Head;
+				if (m_Read == m_Available)
+					return null;
+			}
+
+			int offset = (int)(m_Read & m_Mask);
+			int size = m_Buffer.getInt(offset);
+			if (size < 0)
+			{
+				m_Read += m_Buffer.capacity() - offset;
+				continue;
+			}
+			m_Read += (4 + size + 7) & ~7;
+			m_Record.clear();
+			m_Record.position(offset + 4);
+			m_Record.limit(offset + 4 + size);
+			return m_Record;
+		}
+	}
+
+	// Hands every published record to handler, returns how many there were
+	public int poll(Handler handler)
+	{
+		int count = 0;
+		for (ByteBuffer record = next(); record != null; record = next(), ++count)
+			handler.onRecord(record);
+		return count;
+	}
+
+	// Waits up to timeoutMillis for the producer to publish (or close), then polls
+	public int await(Handler handler, long timeoutMillis) throws InterruptedException
+	{
+		if (m_Read == m_Available && m_Head == m_Read)
+		{
+			long deadline = System.currentTimeMillis() + timeoutMillis;
+			synchronized (this)
+			{
+				m_Waiting = true;
+				try
+				{
+					for (long remaining = timeoutMillis; m_Head == m_Read && !m_Closed && remaining > 0; remaining = deadline - System.currentTimeMillis())
+						wait(remaining);
+				}
+				finally
+				{
+					m_Waiting = false;
+				}
+			}
+		}
+		return poll(handler);
+	}
+}
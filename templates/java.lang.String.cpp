@@ -6,6 +6,7 @@ String::String(String&& o)
 }
 
 String::String(const char* str) : ::java::lang::Object(str ? jni::NewStringUTF(str) : NULL) { __Initialize(); }
+String::String(const char* str, size_t length) : ::java::lang::Object(str ? jni::NewStringUTF8(str, length) : NULL) { __Initialize(); }
 String::~String()
 {
 	if (m_Str)
@@ -1,5 +1,9 @@
 String(String&& o);
 String(const char* str);
+String(const char* str, size_t length);
+#if JNI_STRING_VIEW
+String(std::string_view str) : String(str.data(), str.size()) {}
+#endif
 ~String();
 
 String& operator = (const String& other);
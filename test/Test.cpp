@@ -4,9 +4,19 @@
 
 #include <utility>
 #include <thread>
+#include <atomic>
 
 #include "API.h"
 #include "Proxy.h"
+#include "AsyncProxy.h"
+#include "Executor.h"
+#include "Batch.h"
+#include "Marshal.h"
+#include "ChunkedRange.h"
+#include "Natives.h"
+#include "RingBuffer.h"
+#include "MappedBuffer.h"
+#include "ParallelFor.h"
 
 #if WINDOWS
 #include <windows.h>
@@ -65,6 +75,15 @@ void AssertNumProxies(unsigned expected, const char* detail)
 	}
 }
 
+static jint NativeMeasure(JNIEnv* env, jclass clazz, const String& text, jni::Array<jint> counts, jdouble scale)
+{
+	return static_cast<jint>((text.Length() + counts.Length()) * scale);
+}
+
+static void NativeReset(JNIEnv* env, jobject thiz)
+{
+}
+
 void TestOverrides(JavaVM* vm, JNIEnv* env);
 
 int main(int argc, char** argv)
@@ -80,7 +99,8 @@ int main(int argc, char** argv)
 	JavaVMInitArgs vm_args;
 	memset(&vm_args, 0, sizeof(vm_args));
 
-	const char* jarPath = "build/jnibridge.jar";
+	// jnibridge.jar plus the generated NativeStub_* classes
+	const char* jarPath = "build/osx/jnibridge-test.jar";
 	if (argc > 1)
 		jarPath = argv[1];
 
@@ -490,6 +510,595 @@ int main(int argc, char** argv)
 		runnableProxy.DisableProxy();
 	}
 
+	// -------------------------------------------------------------
+	// Pooled Proxy Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		struct CountingRunnable : public jni::PooledProxy<Runnable>
+		{
+			CountingRunnable() : runCount(0) {}
+			virtual void Run() { ++runCount; }
+			int runCount;
+		};
+
+		CountingRunnable* first = new CountingRunnable;
+		Runnable firstRunnable = *first;
+		firstRunnable.Run();
+		delete first;
+
+		// Reuses the recycled handler, but a stale reference to the first proxy must not reach the second owner
+		CountingRunnable second;
+		Runnable secondRunnable = second;
+		if (jni::IsSameObject(firstRunnable, secondRunnable))
+		{
+			puts("Expected every pooled proxy owner to get its own Java proxy!");
+			abort();
+		}
+
+		firstRunnable.Run();
+		secondRunnable.Run();
+		if (second.runCount != 1)
+		{
+			printf("Expected the second owner to be called once, through its own proxy, but it was called %d times!\n", second.runCount);
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with pooled proxies");
+
+	// -------------------------------------------------------------
+	// Stub Proxy Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		struct StubRunnable : public jni::StubProxy<Runnable>
+		{
+			StubRunnable() : runCount(0) {}
+			virtual void Run() { ++runCount; }
+			int runCount;
+		};
+		struct StubCallable : public jni::StubProxy<concurrent::Callable>
+		{
+			virtual java::lang::Object Call() { return java::lang::Integer(7); }
+		};
+
+		StubRunnable stubRunnable;
+		Runnable runnable = stubRunnable;
+		if (!jni::IsInstanceOf(runnable, Runnable::__Proxy::__STUB_CLASS))
+		{
+			puts("Expected StubProxy to create a NativeStub instance!");
+			abort();
+		}
+		runnable.Run();
+
+		StubCallable stubCallable;
+		concurrent::Callable callable = stubCallable;
+		Integer result(static_cast<jobject>(callable.Call()));
+		if (stubRunnable.runCount != 1 || !result || result.IntValue() != 7)
+		{
+			printf("Unexpected stub proxy results: %d runs, %d returned!\n", stubRunnable.runCount, result ? result.IntValue() : -1);
+			abort();
+		}
+
+		stubRunnable.DisableProxy();
+		runnable.Run();
+		if (stubRunnable.runCount != 1)
+		{
+			puts("Expected a disabled stub proxy not to call into native code!");
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with stub proxies");
+
+#if defined(ENABLE_PROXY_STATISTICS)
+	// -------------------------------------------------------------
+	// Proxy Statistics Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		struct StatisticsRunnable : public jni::Proxy<Runnable>
+		{
+			virtual void Run() {}
+		};
+
+		jni::ProxyStatistics& statistics = StatisticsRunnable::Statistics();
+		statistics.Reset();
+
+		StatisticsRunnable* runnable = new StatisticsRunnable;
+		Runnable javaRunnable = *runnable;
+		javaRunnable.Run();
+		javaRunnable.Run();
+		delete runnable;
+		javaRunnable.Run();
+
+		jlong invocations = statistics.GetTotals().invocations.load();
+		if (invocations != 2 || statistics.GetCallsAfterDisable() != 1)
+		{
+			printf("Expected 2 calls and 1 call after disable, but got %lld and %lld!\n", (long long) invocations, (long long) statistics.GetCallsAfterDisable());
+			abort();
+		}
+		jni::ProxyStatistics::Dump();
+	}
+
+	AbortIfErrors("Failures with proxy statistics");
+#endif
+
+	// -------------------------------------------------------------
+	// Async Proxy Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		static jni::ProxyDispatchQueue queue(4, jni::kProxyDropNewest);
+		struct AsyncRunnable : public jni::AsyncProxy<Runnable>
+		{
+			AsyncRunnable() : runCount(0) {}
+			virtual void Run() { ++runCount; }
+			jni::ProxyDispatchQueue& GetDispatchQueue() override { return queue; }
+			int runCount;
+		};
+
+		AsyncRunnable runnable;
+		Runnable javaRunnable = runnable;
+		for (int i = 0; i < 6; ++i)
+			javaRunnable.Run();
+		if (runnable.runCount != 0 || queue.GetPending() != 4 || queue.GetDropped() != 2)
+		{
+			printf("Expected 4 queued and 2 dropped calls, but got %d run, %u queued and %lld dropped!\n", runnable.runCount, queue.GetPending(), (long long) queue.GetDropped());
+			abort();
+		}
+
+		queue.Drain();
+		if (runnable.runCount != 4)
+		{
+			printf("Expected 4 calls after draining, but got %d!\n", runnable.runCount);
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with async proxies");
+
+	// -------------------------------------------------------------
+	// Executor Test
+	// -------------------------------------------------------------
+	{
+		jni::Executor executor(2);
+		std::future<jint> value = executor.Submit([]() { return java::lang::Integer(4711).IntValue(); });
+		std::future<java::lang::String> string = executor.Submit([]() { return java::lang::String("executor"); });
+		if (value.get() != 4711 || strcmp(string.get().c_str(), "executor") != 0)
+		{
+			puts("Expected executor tasks to call into Java!");
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with executor");
+
+	// -------------------------------------------------------------
+	// Sticky Attach Test
+	// -------------------------------------------------------------
+	{
+		bool scopedDetached = false;
+		bool stickyAttached = false;
+		std::thread thread([&]()
+		{
+			{
+				jni::LocalScope frame;
+				java::lang::Integer(1);
+			}
+			scopedDetached = jni::GetEnv() == NULL;
+
+			jni::SetThreadAttachPolicy(jni::kJNI_ATTACH_STICKY);
+			{
+				jni::LocalScope frame;
+				java::lang::Integer(2);
+			}
+			stickyAttached = jni::GetEnv() != NULL;
+		});
+		thread.join();
+
+		if (!scopedDetached || !stickyAttached)
+		{
+			printf("Expected scoped attach to detach (%d) and sticky attach to stay attached (%d)!\n", scopedDetached, stickyAttached);
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with sticky attach");
+
+	// -------------------------------------------------------------
+	// Batch Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		jni::Batch batch;
+		static jmethodID printlnMID = jni::GetMethodID(jni::GetObjectClass(System::fOut()), "println", "(Ljava/lang/String;)V");
+		batch.Call(System::fOut(), printlnMID, java::lang::String("batched 1"));
+		batch.Call(System::fOut(), printlnMID, java::lang::String("batched 2"));
+		// Only explicit calls are recorded, this one runs right away
+		System::fOut().Println("not batched");
+		if (batch.Size() != 2 || batch.Execute() != -1 || batch.Size() != 0)
+		{
+			puts("Expected 2 recorded calls to execute!");
+			abort();
+		}
+
+		static jmethodID intValueMID = jni::GetMethodID(java::lang::Integer::__CLASS, "intValue", "()I");
+		batch.Call(java::lang::Integer(42), intValueMID);
+		if (batch.Execute() != -1 || java::lang::Integer(batch.GetResult(0)).IntValue() != 42)
+		{
+			puts("Expected batched Integer.intValue() to return 42!");
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with batches");
+
+	// -------------------------------------------------------------
+	// Marshal Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		std::unordered_map<std::string, std::string> properties;
+		if (!jni::ToNative(System::GetProperties(), properties) || properties["java.version"].empty())
+		{
+			puts("Expected System.getProperties() to contain java.version!");
+			abort();
+		}
+		printf("Marshalled %d properties, java.version: %s\n", (int) properties.size(), properties["java.version"].c_str());
+
+		jni::MarshalMap values;
+		values["int"] = jni::MarshalValue(jint(42));
+		values["double"] = jni::MarshalValue(jdouble(0.5));
+		values["string"] = jni::MarshalValue("value");
+		values["null"] = jni::MarshalValue();
+
+		jni::MarshalMap roundTrip;
+		if (!jni::ToNative(jni::ToJavaMap(values), roundTrip) || roundTrip.size() != 4
+			|| roundTrip["int"].type != jni::MarshalValue::kInt || roundTrip["int"].integer != 42
+			|| roundTrip["double"].real != 0.5 || roundTrip["string"].string != "value" || !roundTrip["null"].IsNull())
+		{
+			puts("Expected marshalled map to survive a round trip!");
+			abort();
+		}
+
+		std::vector<std::string> list;
+		list.push_back("a");
+		list.push_back("b");
+		std::vector<std::string> listRoundTrip;
+		if (!jni::ToNative(jni::ToJavaList(list), listRoundTrip) || listRoundTrip != list)
+		{
+			puts("Expected marshalled list to survive a round trip!");
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with marshalling");
+
+	// -------------------------------------------------------------
+	// Chunked Range Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		Properties properties = System::GetProperties();
+
+		int expected = 0;
+		for (Enumeration keys = properties.Keys(); keys.HasMoreElements(); keys.NextElement())
+			++expected;
+
+		int count = 0;
+		for (String key : jni::ChunkedRange<String>(properties.Keys(), 7))
+		{
+			if (properties.GetProperty(key))
+				++count;
+		}
+
+		int rawCount = 0;
+		for (jobject key : jni::ChunkedRange<>(properties.Keys()))
+			rawCount += key != NULL;
+
+		if (count != expected || rawCount != expected)
+		{
+			printf("Expected %d keys from chunked ranges, but got %d and %d!\n", expected, count, rawCount);
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with chunked ranges");
+
+	// -------------------------------------------------------------
+	// Compact Method Table Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		static const jni::MethodDescriptor descriptors[] = {
+			{ "parseInt", "(Ljava/lang/String;)I", true, 'I' },
+			{ "intValue", "()I", false, 'I' },
+			{ "toString", "()Ljava/lang/String;", false, 'L' },
+		};
+		static std::atomic<jmethodID> ids[3];
+		static jni::MethodTable table = { Integer::__CLASS, descriptors, ids };
+
+		jint parsed = jni::CallStaticMethod<jint>(table, 0, static_cast<jobject>(String("4711")));
+		Integer integer(parsed);
+		jint value = jni::CallMethod<jint>(integer, table, 1);
+		String text(jni::CallMethod<jobject>(integer, table, 2));
+		if (parsed != 4711 || value != 4711 || strcmp(text.c_str(), "4711") != 0)
+		{
+			printf("Expected 4711 through the method table, but got %d, %d and '%s'!\n", parsed, value, text.c_str());
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with compact method tables");
+
+	// -------------------------------------------------------------
+	// Unchecked Call Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		static jmethodID hashCodeMID = jni::GetMethodID(String::__CLASS, "hashCode", "()I");
+		static jmethodID valueOfMID = jni::GetStaticMethodID(String::__CLASS, "valueOf", "(I)Ljava/lang/String;");
+		String text("unchecked");
+		jint checked = jni::Op<jint>::CallMethod(text, hashCodeMID);
+		jint unchecked = jni::Op<jint>::CallMethodUnchecked(text, hashCodeMID);
+		String value(jni::Op<jstring>::CallStaticMethodUnchecked(String::__CLASS, valueOfMID, 42));
+		if (checked != unchecked || strcmp(value.c_str(), "42") != 0)
+		{
+			printf("Expected unchecked calls to match, but got %d, %d and '%s'!\n", checked, unchecked, value.c_str());
+			abort();
+		}
+
+		// The parameter check stays, a null receiver is reported instead of crashing in the VM
+		if (jni::Op<jint>::CallMethodUnchecked(NULL, hashCodeMID) != 0 || jni::CheckError() != jni::kJNI_INVALID_PARAMETERS)
+		{
+			puts("Expected an unchecked call on null to report invalid parameters!");
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with unchecked calls");
+
+	// -------------------------------------------------------------
+	// Natives Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		jni::NativeMethod measure = JNI_NATIVE_METHOD("nativeMeasure", NativeMeasure);
+		jni::NativeMethod reset = JNI_NATIVE_METHOD("nativeReset", NativeReset);
+		if (measure.signature != "(Ljava/lang/String;[ID)I" || reset.signature != "()V")
+		{
+			printf("Unexpected native signatures %s and %s!\n", measure.signature.c_str(), reset.signature.c_str());
+			abort();
+		}
+
+		typedef jint (JNICALL *MeasureThunk)(JNIEnv*, jclass, jobject, jobject, jdouble);
+		jint measured = reinterpret_cast<MeasureThunk>(measure.function)(frame, String::__CLASS, String("natives"), jni::Array<jint>(3), 2.0);
+		if (measured != 20)
+		{
+			printf("Expected 20 from the native thunk, but got %d!\n", measured);
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with natives");
+
+	// -------------------------------------------------------------
+	// Result Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		static jni::Class numberFormatException("java/lang/NumberFormatException");
+		static jmethodID parseIntMID = jni::GetStaticMethodID(Integer::__CLASS, "parseInt", "(Ljava/lang/String;)I");
+		jni::Result<jint> parsed = jni::Op<jint>::TryCallStaticMethod(Integer::__CLASS, parseIntMID, static_cast<jobject>(String("1234")));
+		jni::Result<jint> failed = jni::Op<jint>::TryCallStaticMethod(Integer::__CLASS, parseIntMID, static_cast<jobject>(String("12x4")));
+		if (!parsed || parsed.value != 1234 || parsed.exception)
+		{
+			printf("Expected 1234 from TryCallStaticMethod, but got %d (error %d)!\n", parsed.value, parsed.error);
+			abort();
+		}
+		if (failed || failed.error != jni::kJNI_EXCEPTION_THROWN || !jni::IsInstanceOf(failed.exception, numberFormatException))
+		{
+			printf("Expected a NumberFormatException from TryCallStaticMethod, but got error %d!\n", failed.error);
+			abort();
+		}
+		if (jni::PeekError() != jni::kJNI_NO_ERROR)
+		{
+			printf("Expected TryCallStaticMethod to leave the error state alone, but got %d!\n", jni::PeekError());
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with call results");
+
+	// -------------------------------------------------------------
+	// UTF-8 String Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		// A 2, 3 and 4 byte sequence, an invalid byte and a slice that isn't NUL terminated
+		const char text[] = "{\"message\":\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \xff\"}, trailing";
+		String json(text, strlen(text) - strlen(", trailing"));
+		static jmethodID charAtMID = jni::GetMethodID(String::__CLASS, "charAt", "(I)C");
+		if (json.Length() != 25 || jni::Op<jchar>::CallMethod(json, charAtMID, 19) != 0xD83D || jni::Op<jchar>::CallMethod(json, charAtMID, 20) != 0xDE00
+			|| jni::Op<jchar>::CallMethod(json, charAtMID, 22) != 0xFFFD)
+		{
+			printf("Unexpected UTF-16 string '%s' of length %d!\n", json.c_str(), json.Length());
+			abort();
+		}
+
+		String empty(text, 0);
+		if (empty.Length() != 0)
+		{
+			puts("Expected an empty string from a zero length slice");
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with UTF-8 strings");
+
+	// -------------------------------------------------------------
+	// Ring Buffer Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		static jni::Class ringBufferClass("bitter/jnibridge/RingBuffer");
+		static jni::Class byteBufferClass("java/nio/ByteBuffer");
+		static jni::Class mappedBufferClass("bitter/jnibridge/MappedBuffer");
+		static jmethodID bufferMID = jni::GetMethodID(mappedBufferClass, "buffer", "()Ljava/nio/ByteBuffer;");
+		static jmethodID closeMID = jni::GetMethodID(mappedBufferClass, "close", "()V");
+		static jmethodID duplicateMID = jni::GetMethodID(byteBufferClass, "duplicate", "()Ljava/nio/ByteBuffer;");
+		static jmethodID nextMID = jni::GetMethodID(ringBufferClass, "next", "()Ljava/nio/ByteBuffer;");
+		static jmethodID getIntMID = jni::GetMethodID(byteBufferClass, "getInt", "()I");
+
+		// Eight 4 byte records fill 64 bytes, the ninth only fits once the consumer caught up
+		jni::RingBuffer ring(64);
+		int written = 0;
+		while (ring.Write(static_cast<jint>(written)))
+			++written;
+		ring.Publish();
+
+		int read = 0;
+		for (jobject record; (record = jni::Op<jobject>::CallMethod(ring.GetJavaObject(), nextMID)); ++read)
+		{
+			if (jni::Op<jint>::CallMethod(record, getIntMID) != read)
+			{
+				printf("Expected record %d from the ring buffer!\n", read);
+				abort();
+			}
+			jni::DeleteLocalRef(record);
+		}
+
+		// After seven more records a 12 byte one doesn't fit in the last 8 bytes and wraps around
+		bool wrapped = true;
+		for (jint i = 0; i < 7; ++i)
+			wrapped = wrapped && ring.Write(i);
+		ring.Publish();
+		for (jobject record; (record = jni::Op<jobject>::CallMethod(ring.GetJavaObject(), nextMID)); )
+			jni::DeleteLocalRef(record);
+		jint triple[3] = { 1, 2, 3 };
+		wrapped = wrapped && ring.Write(triple);
+		ring.Publish();
+		jobject record = jni::Op<jobject>::CallMethod(ring.GetJavaObject(), nextMID);
+		jint value = record ? jni::Op<jint>::CallMethod(record, getIntMID) : 0;
+		if (written != 8 || read != 8 || !wrapped || value != 1)
+		{
+			printf("Unexpected ring buffer results: %d written, %d read, wrapped %d, value %d!\n", written, read, wrapped, value);
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with ring buffers");
+
+	// -------------------------------------------------------------
+	// Mapped Buffer Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		static jni::Class byteBufferClass("java/nio/ByteBuffer");
+		static jni::Class mappedBufferClass("bitter/jnibridge/MappedBuffer");
+		static jmethodID bufferMID = jni::GetMethodID(mappedBufferClass, "buffer", "()Ljava/nio/ByteBuffer;");
+		static jmethodID closeMID = jni::GetMethodID(mappedBufferClass, "close", "()V");
+		static jmethodID duplicateMID = jni::GetMethodID(byteBufferClass, "duplicate", "()Ljava/nio/ByteBuffer;");
+		static jmethodID getMID = jni::GetMethodID(byteBufferClass, "get", "(I)B");
+		static jmethodID putMID = jni::GetMethodID(byteBufferClass, "put", "(IB)Ljava/nio/ByteBuffer;");
+		static jmethodID isReadOnlyMID = jni::GetMethodID(byteBufferClass, "isReadOnly", "()Z");
+
+		const char* path = "jnibridge_mapped_test.bin";
+		FILE* file = fopen(path, "wb");
+		for (int i = 0; i < 10000; ++i)
+			fputc(i & 0x7f, file);
+		fclose(file);
+
+		{
+			// Not page aligned on purpose
+			jni::MappedBuffer readOnly(path, jni::MappedBuffer::kReadOnly, 4097, 100);
+			jobject owner = readOnly.NewJavaObject();
+			jobject buffer = owner ? jni::Op<jobject>::CallMethod(owner, bufferMID) : NULL;
+			if (!readOnly.IsValid() || readOnly.GetSize() != 100 || !buffer || !jni::Op<jboolean>::CallMethod(buffer, isReadOnlyMID)
+				|| jni::Op<jbyte>::CallMethod(buffer, getMID, 0) != (4097 & 0x7f) || !readOnly.Advise(jni::MappedBuffer::kAdviceSequential))
+			{
+				puts("Unexpected read-only mapping");
+				abort();
+			}
+
+			// The owner keeps the mapping after the native side is gone, no matter which buffers are still reachable
+			jobject view = jni::Op<jobject>::CallMethod(buffer, duplicateMID);
+			jni::DeleteLocalRef(buffer);
+			readOnly = jni::MappedBuffer("jnibridge_missing_file.bin");
+			if (jni::Op<jbyte>::CallMethod(view, getMID, 99) != ((4097 + 99) & 0x7f))
+			{
+				puts("Expected the Java owner to keep the mapping alive");
+				abort();
+			}
+			jni::Op<jvoid>::CallMethod(owner, closeMID);
+			jni::Op<jvoid>::CallMethod(owner, closeMID);
+		}
+
+		{
+			jni::MappedBuffer readWrite(path, jni::MappedBuffer::kReadWrite);
+			jni::MappedBuffer copy = readWrite;
+			jobject owner = copy.NewJavaObject();
+			jobject buffer = jni::Op<jobject>::CallMethod(owner, bufferMID);
+			jni::DeleteLocalRef(jni::Op<jobject>::CallMethod(buffer, putMID, 9999, static_cast<jbyte>(42)));
+			jni::Op<jvoid>::CallMethod(owner, closeMID);
+			if (readWrite.GetSize() != 10000 || static_cast<char*>(readWrite.GetData())[9999] != 42 || !copy.Flush())
+			{
+				puts("Unexpected read-write mapping");
+				abort();
+			}
+		}
+
+		if (jni::MappedBuffer("jnibridge_missing_file.bin").IsValid())
+		{
+			puts("Expected mapping a missing file to fail");
+			abort();
+		}
+		remove(path);
+	}
+
+	AbortIfErrors("Failures with mapped buffers");
+
+	// -------------------------------------------------------------
+	// Parallel For Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalScope frame;
+		const jsize length = 100000;
+		jfloat* values = new jfloat[length];
+		for (jsize i = 0; i < length; ++i)
+			values[i] = static_cast<jfloat>(i);
+		jni::Array<jfloat> array(length, values);
+		delete[] values;
+
+		std::atomic<jsize> processed(0);
+		bool doubled = jni::ParallelFor(array, [&](jfloat* elements, jsize begin, jsize end)
+		{
+			for (jsize i = begin; i < end; ++i)
+				elements[i] *= 2.0f;
+			processed += end - begin;
+		}, jni::kPinCritical, true, 1000);
+		if (!doubled || processed != length || array[0] != 0.0f || array[12345] != 24690.0f || array[length - 1] != 2.0f * (length - 1))
+		{
+			printf("Unexpected critical ParallelFor result: %d elements\n", processed.load());
+			abort();
+		}
+
+		jni::ParallelFor(array, [](jfloat* elements, jsize begin, jsize end)
+		{
+			for (jsize i = begin; i < end; ++i)
+				elements[i] += 1.0f;
+		}, jni::kPinElements);
+		if (array[12345] != 24691.0f || jni::ParallelFor(jni::Array<jfloat>(static_cast<jobject>(NULL)), [](jfloat*, jsize, jsize) {}))
+		{
+			puts("Unexpected ParallelFor result with pinned elements");
+			abort();
+		}
+	}
+
+	AbortIfErrors("Failures with parallel array processing");
+
 	// -------------------------------------------------------------
 	// Move semantics
 	// -------------------------------------------------------------